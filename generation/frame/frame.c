@@ -0,0 +1,226 @@
+#include "frame.h"
+#include "../walk/walk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int frame_type_size(TokenType type) {
+    switch (type) {
+        case token_type_char_t:
+        case token_type_char_v: return 1;
+        case token_type_short:  return 2;
+        case token_type_int:    return 4;
+        default:                return 8; // long and anything unknown
+    }
+}
+
+// a variable waiting for its offset
+typedef struct FrameVar {
+    int* offset; // where the offset goes
+    int size;
+    uint32_t scope;
+} FrameVar;
+
+#define FRAME_NO_SCOPE UINT32_MAX
+
+// a block with its own variables, the same blocks the generator scopes
+typedef struct FrameScope {
+    uint32_t parent;  // FRAME_NO_SCOPE for the outermost block of a frame
+    int bytes[4];     // own variables per size class, 8 4 2 1
+    int size;         // all own variables
+    int align;        // largest variable here or in any nested block
+    int extent;       // bytes taken by this block and everything nested in it
+    int base;         // bytes of the frame above this block
+    int at[4];        // next offset per size class, while placing
+} FrameScope;
+
+typedef struct FrameMark {
+    size_t var;   // first var of the frame
+    size_t scope; // its outermost block
+} FrameMark;
+
+typedef struct FrameBuilder {
+    const NodeProg* prog;
+    FrameLayout* out;
+    kvec_t(FrameVar) vars;     // of every frame still open, innermost last
+    kvec_t(FrameScope) scopes; // the same
+    kvec_t(uint32_t) open;     // blocks being walked, innermost last
+    kvec_t(FrameMark) frames;  // every frame still open
+} FrameBuilder;
+
+static int size_class(int size) {
+    switch (size) {
+        case 8:  return 0;
+        case 4:  return 1;
+        case 2:  return 2;
+        default: return 3;
+    }
+}
+
+static int align_up(int n, int align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+static void frame_add(FrameBuilder* b, int* offset, TokenType type) {
+    FrameVar v = { offset, frame_type_size(type), kv_A(b->open, kv_size(b->open) - 1) };
+    kv_push(FrameVar, b->vars, v);
+}
+
+static void scope_open(FrameBuilder* b, bool frame) {
+    FrameScope s;
+    memset(&s, 0, sizeof(s));
+    s.parent = frame ? FRAME_NO_SCOPE : kv_A(b->open, kv_size(b->open) - 1);
+    kv_push(FrameScope, b->scopes, s);
+    kv_push(uint32_t, b->open, (uint32_t)(kv_size(b->scopes) - 1));
+}
+
+// places the vars of the frame and drops it, returns the frame size.
+// sibling blocks are never live together, so they all start at the same
+// offset, right below the variables of the block around them
+static int frame_close(FrameBuilder* b, FrameMark mark) {
+    for (size_t i = mark.var; i < kv_size(b->vars); i++) {
+        FrameVar* v = &kv_A(b->vars, i);
+        FrameScope* s = &kv_A(b->scopes, v->scope);
+        s->bytes[size_class(v->size)] += v->size;
+        s->size += v->size;
+        if (s->align < v->size) s->align = v->size;
+    }
+
+    // nested blocks come after the block around them, so backwards is leaves first
+    for (size_t i = kv_size(b->scopes); i-- > mark.scope;) {
+        FrameScope* s = &kv_A(b->scopes, i);
+        if (s->extent < s->size) s->extent = s->size;
+        if (s->parent == FRAME_NO_SCOPE || s->extent == 0) continue;
+        FrameScope* p = &kv_A(b->scopes, s->parent);
+        int end = align_up(p->size, s->align) + s->extent;
+        if (p->extent < end) p->extent = end;
+        if (p->align < s->align) p->align = s->align;
+    }
+
+    // largest first inside a block, each block starts aligned to its largest
+    // variable, so every variable is aligned to its own size
+    for (size_t i = mark.scope; i < kv_size(b->scopes); i++) {
+        FrameScope* s = &kv_A(b->scopes, i);
+        int base = 0;
+        if (s->parent != FRAME_NO_SCOPE && s->extent != 0) {
+            FrameScope* p = &kv_A(b->scopes, s->parent);
+            base = p->base + align_up(p->size, s->align);
+        }
+        s->base = base;
+        for (int c = 0; c < 4; c++) {
+            s->at[c] = base;
+            base += s->bytes[c];
+        }
+    }
+    for (size_t i = mark.var; i < kv_size(b->vars); i++) {
+        FrameVar* v = &kv_A(b->vars, i);
+        int* at = &kv_A(b->scopes, v->scope).at[size_class(v->size)];
+        *at += v->size;
+        *v->offset = *at; // [rbp - offset] is its first byte
+    }
+
+    int size = align_up(kv_A(b->scopes, mark.scope).extent, 16);
+    b->vars.n = mark.var;
+    b->scopes.n = mark.scope;
+    return size;
+}
+
+static void frame_open(FrameBuilder* b) {
+    FrameMark mark = { kv_size(b->vars), kv_size(b->scopes) };
+    kv_push(FrameMark, b->frames, mark);
+    scope_open(b, true);
+}
+
+// bodies of every block plus the init of a for, which declares the loop variable
+static bool frame_child(const NodeProg* prog, const NodeStmt* stmt, uint32_t i, StmtId* out) {
+    if (stmt->kind == NODE_STMT_FOR) {
+        if (i == 0) { *out = stmt->as.for_.cond1; return true; }
+        return walk_list_child(prog, stmt->as.for_.body, i - 1, out);
+    }
+    return walk_body_child(prog, stmt, i, out);
+}
+
+static int frame_enter(void* ctx, const NodeStmt* stmt) {
+    FrameBuilder* b = ctx;
+    const NodeProg* prog = b->prog;
+    StmtId id = ast_stmt_id(prog, stmt);
+    switch (stmt->kind) {
+        case NODE_STMT_CHAR:  frame_add(b, &b->out->var_offset[id], token_type_char_t); break;
+        case NODE_STMT_SHORT: frame_add(b, &b->out->var_offset[id], token_type_short); break;
+        case NODE_STMT_INT:   frame_add(b, &b->out->var_offset[id], token_type_int); break;
+        case NODE_STMT_LONG:  frame_add(b, &b->out->var_offset[id], token_type_long); break;
+        case NODE_STMT_IF:
+        case NODE_STMT_ELSE:
+        case NODE_STMT_WHILE:
+        case NODE_STMT_FOR:
+            scope_open(b, false);
+            break;
+        case NODE_STMT_FUNC:
+            frame_open(b);
+            for (uint32_t i = 0; i + 1 < stmt->as.func.types.count; i += 2) {
+                TokenType type = ast_tok(prog, ast_list_at(prog, stmt->as.func.types, i)).type;
+                TokId name = ast_list_at(prog, stmt->as.func.types, i + 1);
+                frame_add(b, &b->out->param_offset[name], type);
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static void frame_leave(void* ctx, const NodeStmt* stmt, int state) {
+    FrameBuilder* b = ctx;
+    (void)state;
+    switch (stmt->kind) {
+        case NODE_STMT_IF:
+        case NODE_STMT_ELSE:
+        case NODE_STMT_WHILE:
+        case NODE_STMT_FOR:
+            b->open.n--;
+            break;
+        case NODE_STMT_FUNC:
+            b->open.n--;
+            b->out->frame_size[ast_stmt_id(b->prog, stmt)] = frame_close(b, kv_pop(b->frames));
+            break;
+        default:
+            break;
+    }
+}
+
+static const StmtPass frame_pass = { frame_child, frame_enter, frame_leave };
+
+static int* frame_table(size_t n) {
+    int* t = (int*)malloc(sizeof(int) * (n ? n : 1));
+    if (!t) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    for (size_t i = 0; i < n; i++) t[i] = -1;
+    return t;
+}
+
+void frame_layout(const NodeProg* prog, FrameLayout* out) {
+    out->var_offset = frame_table(kv_size(prog->stmts));
+    out->frame_size = frame_table(kv_size(prog->stmts));
+    out->param_offset = frame_table(kv_size(prog->toks));
+
+    FrameBuilder b;
+    b.prog = prog;
+    b.out = out;
+    kv_init(b.vars);
+    kv_init(b.scopes);
+    kv_init(b.open);
+    kv_init(b.frames);
+    frame_open(&b); // the top-level code
+    walk_stmt_list(prog, prog->stmt, &frame_pass, &b);
+    out->main_size = frame_close(&b, kv_pop(b.frames));
+    kv_destroy(b.vars);
+    kv_destroy(b.scopes);
+    kv_destroy(b.open);
+    kv_destroy(b.frames);
+}
+
+void frame_layout_free(FrameLayout* f) {
+    free(f->var_offset);
+    free(f->param_offset);
+    free(f->frame_size);
+    f->var_offset = f->param_offset = f->frame_size = NULL;
+}
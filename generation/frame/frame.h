@@ -0,0 +1,25 @@
+#pragma once
+
+#include "../../parser/parser.h"
+
+// ---- Frame layout ----
+// one frame per function plus one for the top-level code. every variable
+// declared anywhere in a frame, parameters included, gets its rbp offset
+// once, before any code is generated. the frame is reserved with a single
+// sub rsp in the prologue.
+// variables are placed largest first within their block, so each one is
+// aligned to its own size. blocks that are never live together (the bodies
+// of sibling if / else / while / for) share the same bytes, a block starts
+// right below the variables of the block around it.
+typedef struct FrameLayout {
+    int* var_offset;   // by StmtId of the declaration, -1 for other statements
+    int* param_offset; // by TokId of the parameter's name, -1 for other tokens
+    int* frame_size;   // by StmtId of a function, bytes below rbp (16 byte multiple)
+    int main_size;     // the same for the top-level code
+} FrameLayout;
+
+void frame_layout(const NodeProg* prog, FrameLayout* out);
+void frame_layout_free(FrameLayout* f);
+
+// bytes a variable of this type takes in the frame
+int frame_type_size(TokenType type);
@@ -6,68 +6,63 @@
 #include <string.h>
 #include <stdarg.h>
 #include "./helper/helper.h"
+#include "./walk/walk.h"
 
 
 void handle_vars(gen_data* g, const NodeStmt* stmt) {
-    char* s = "";
-    int int_char_check = 0;
+    int offset = g->m_frame.var_offset[ast_stmt_id(g->m_prog, stmt)];
     switch (stmt->kind) {
         case NODE_STMT_INT: 
-            s = strdup(stmt->as.int_.ident.value); 
-            if (stmt->as.int_.expr.kind == NODE_EXPR_CHAR) {
+            if (ast_expr(g->m_prog, stmt->as.int_.expr)->kind == NODE_EXPR_CHAR) {
                 printf("error: cannot assign value of type 'char' to variable of type 'int'\n");
                 exit(1);
             }
+            declare_var(g, ast_tok(g->m_prog, stmt->as.int_.ident).sym, token_type_int, offset);
             break;
         case NODE_STMT_SHORT: 
-            s = strdup(stmt->as.short_.ident.value); 
-            if (stmt->as.short_.expr.kind == NODE_EXPR_CHAR) {
+            if (ast_expr(g->m_prog, stmt->as.short_.expr)->kind == NODE_EXPR_CHAR) {
                 printf("error: cannot assign value of type 'char' to variable of type 'int'\n");
                 exit(1);
             }
+            declare_var(g, ast_tok(g->m_prog, stmt->as.short_.ident).sym, token_type_short, offset);
             break;
         case NODE_STMT_LONG: 
-            s = strdup(stmt->as.long_.ident.value); 
-            if (stmt->as.long_.expr.kind == NODE_EXPR_CHAR) {
+            if (ast_expr(g->m_prog, stmt->as.long_.expr)->kind == NODE_EXPR_CHAR) {
                 printf("error: cannot assign value of type 'char' to variable of type 'int'\n");
                 exit(1);
             }
+            declare_var(g, ast_tok(g->m_prog, stmt->as.long_.ident).sym, token_type_long, offset);
+            break;
+        case NODE_STMT_CHAR:
+            declare_var(g, ast_tok(g->m_prog, stmt->as.char_.ident).sym, token_type_char_t, offset);
             break;
-        case NODE_STMT_CHAR: s = strdup(stmt->as.char_.ident.value); break;
-    }
-    // pushing the var for block visibility
-    if (kv_size(*g->m_block) > 0) {
-        size_t last_row_index = kv_size(*g->m_block) - 1;
-        StrVec *last_row = &kv_A(*g->m_block, last_row_index);
-        if (!s || s == "") { perror("strdup"); exit(1); }
-        kv_push(char*, *last_row, s); 
     }
 
     switch(stmt->kind) {
         case NODE_STMT_SHORT: {
-            gen_expr_to_rax(g,&stmt->as.short_.expr, stmt);
-            int slot = lookup_var_slot(g, stmt->as.short_.ident.value);
+            gen_expr_to_rax(g, stmt->as.short_.expr, stmt);
+            int slot = lookup_var_slot(g, ast_tok(g->m_prog, stmt->as.short_.ident).sym);
             int off = slot_to_offset(g,slot);
             emit(g, "   mov word [rbp - %d], ax\n", off);
             return;
         }
         case NODE_STMT_LONG: {
-            gen_expr_to_rax(g,&stmt->as.long_.expr, stmt);
-            int slot = lookup_var_slot(g, stmt->as.long_.ident.value);
+            gen_expr_to_rax(g, stmt->as.long_.expr, stmt);
+            int slot = lookup_var_slot(g, ast_tok(g->m_prog, stmt->as.long_.ident).sym);
             int off = slot_to_offset(g,slot);
             emit(g, "   mov qword [rbp - %d], rax\n", off);
             return;
         }
         case NODE_STMT_INT: {
-            gen_expr_to_rax(g, &stmt->as.int_.expr, stmt);
-            int slot = lookup_var_slot(g, stmt->as.int_.ident.value);
+            gen_expr_to_rax(g, stmt->as.int_.expr, stmt);
+            int slot = lookup_var_slot(g, ast_tok(g->m_prog, stmt->as.int_.ident).sym);
             int off = slot_to_offset(g,slot);
             emit(g, "   mov dword [rbp - %d], eax\n", off);
             return;
         }
         case NODE_STMT_CHAR: {
-            gen_expr_to_rax(g, &stmt->as.char_.expr, stmt);
-            int slot = lookup_var_slot(g, stmt->as.char_.ident.value);
+            gen_expr_to_rax(g, stmt->as.char_.expr, stmt);
+            int slot = lookup_var_slot(g, ast_tok(g->m_prog, stmt->as.char_.ident).sym);
             int off = slot_to_offset(g,slot);
             emit(g, "   mov byte [rbp - %d], al\n", off);
             return;
@@ -75,56 +70,57 @@ void handle_vars(gen_data* g, const NodeStmt* stmt) {
     }
 }
 
-void gen_stmt(gen_data* g, const NodeStmt* stmt) {
-    if (!stmt) return;
+// ---- Statements ----
+// everything up to the body of a block statement, the body is walked by
+// gen_stmt() and gen_stmt_leave() closes the block. returns the label id
+// the block needs again at its end
+static int gen_stmt_enter(void* ctx, const NodeStmt* stmt) {
+    gen_data* g = ctx;
 
 
     if (stmt->kind == NODE_STMT_RETURN) {
-        gen_expr_to_rax(g, &stmt->as.return_.res,stmt);
-        return;
+        gen_expr_to_rax(g, stmt->as.return_.res, stmt);
+        return 0;
     }
 
     if (stmt->kind == NODE_STMT_SHORT) {
         handle_vars(g,stmt);
-        return;
+        return 0;
     } 
     if (stmt->kind == NODE_STMT_LONG) {
         handle_vars(g,stmt);
-        return;
+        return 0;
     } 
 
     if (stmt->kind == NODE_STMT_INT) {
         handle_vars(g,stmt);
-        return;
+        return 0;
     } 
     if (stmt->kind == NODE_STMT_CHAR) {
         handle_vars(g,stmt);
-        return;
+        return 0;
     }
 
     if (stmt->kind == NODE_STMT_FUNC) {
         int id = next_label();
         emit(g,"   jmp _placeholder%d\n",id);
-        emit(g,"_%s:\n", stmt->as.func.name.value);
+        emit(g,"_%s:\n", token_value(ast_tok(g->m_prog, stmt->as.func.name)));
         emit(g,"   push rbp\n");
         emit(g,"   mov rbp, rsp\n");
+        int frame = g->m_frame.frame_size[ast_stmt_id(g->m_prog, stmt)];
+        if (frame > 0) emit(g, "   sub rsp, %d\n", frame);
 
+        // params live in the function's block
+        enter_scope(g);
 
+        for (uint32_t i = 0; i < stmt->as.func.types.count / 2; i++) {
+            int type_num = ast_tok(g->m_prog, ast_list_at(g->m_prog, stmt->as.func.types, 2 * i)).type;
+            TokId name_id = ast_list_at(g->m_prog, stmt->as.func.types, 2 * i + 1);
+            Token name_tok = ast_tok(g->m_prog, name_id);
 
-        for (int i = 0; i < kv_size(stmt->as.func.types); i++) {
-            int type_num = kv_A(stmt->as.func.types, i).pair[0].type;
-            char *name = kv_A(stmt->as.func.types, i).pair[1].value;
-
-            ensure_var_slot(g, name,type_num);
+            declare_var(g, name_tok.sym, type_num, g->m_frame.param_offset[name_id]);
             printf("type num is: %d\n", type_num);
 
-            // adding arg type so when using function we can acess it by name
-            args_func arg;
-            arg.name = name;
-            kv_init(arg.arg_types);
-            kv_push(int, arg.arg_types, type_num);
-            kv_push(args_func, *g->m_func, arg);
-
             size_t arg_size;
             const char *reg_part = NULL;
 
@@ -194,79 +190,66 @@ void gen_stmt(gen_data* g, const NodeStmt* stmt) {
 
             emit(g, "   mov %s, %s\n", reg_part, src_reg);
 
-            int push_size = (arg_size + 15) & ~15;
-            emit(g, "   sub rsp, %zu\n", push_size);
-
-
-            int slot = lookup_var_slot(g, name);
+            int slot = lookup_var_slot(g, name_tok.sym);
             int offset = slot_to_offset(g, slot);
             if (arg_size == 1)
-                emit(g, "   mov byte [rbp-%zu], %s\n", offset, src_reg);
+                emit(g, "   mov byte [rbp-%d], %s\n", offset, src_reg);
             else if (arg_size == 2)
-                emit(g, "   mov word [rbp-%zu], %s\n", offset, src_reg);
+                emit(g, "   mov word [rbp-%d], %s\n", offset, src_reg);
             else if (arg_size == 4)
-                emit(g, "   mov dword [rbp-%zu], %s\n", offset, src_reg);
+                emit(g, "   mov dword [rbp-%d], %s\n", offset, src_reg);
             else // 8 bytes
-                emit(g, "   mov qword [rbp-%zu], %s\n", offset, src_reg);
-        }
-        StrVec row;
-        kv_init(row);
-        kv_push(StrVec, *g->m_block, row);
-        for (size_t i = 0; i < kv_size(stmt->as.func.body); ++i) {
-            gen_stmt(g, &kv_A(stmt->as.func.body, i));
+                emit(g, "   mov qword [rbp-%d], %s\n", offset, src_reg);
         }
-        emit(g, "   leave\n");
-        emit(g, "   ret\n");
-        emit(g,"_placeholder%d:\n", id);
-        delete_local_var(g);
-        remove_last_block(g);
-        return;
+        return id;
     }
 
 
 
     if (stmt->kind == NODE_STMT_VCHANGE) {
         printf("hey\n");
-        gen_expr_to_rax(g, &stmt->as.vchange.expr, stmt);
-        int slot = lookup_var_slot(g, stmt->as.vchange.ident.value);
+        gen_expr_to_rax(g, stmt->as.vchange.expr, stmt);
+        int slot = lookup_var_slot(g, ast_tok(g->m_prog, stmt->as.vchange.ident).sym);
         int off = slot_to_offset(g,slot);
-        int type = get_type_by_name(g,stmt->as.vchange.ident.value);
+        int type = get_type_by_name(g, ast_tok(g->m_prog, stmt->as.vchange.ident).sym);
         emit_ident_to_move(g, off, type);
-        return;
+        return 0;
     }
 
 
     if (stmt->kind == NODE_STMT_FUNC_USE) {
-        for (int i = 0; i < kv_size(*g->m_func); i++) {
-            args_func arg = kv_A(*g->m_func, i);
+        func_sig sig;
+        if (!lookup_func(g, ast_tok(g->m_prog, stmt->as.func_call.name).sym, &sig)) {
+            printf("error: call to undefined function '%s'\n",
+                token_value(ast_tok(g->m_prog, stmt->as.func_call.name)));
+            exit(1);
+        }
+        if (sig.arity != stmt->as.func_call.args.count) {
+            printf("error: function '%s' called with wrong number of arguments\n",
+                token_value(ast_tok(g->m_prog, stmt->as.func_call.name)));
+            exit(1);
+        }
 
-            if (kv_size(arg.arg_types) != kv_size(stmt->as.func_call.args)) {
-                printf("error: function '%s' called with wrong number of arguments\n",
-                    stmt->as.func_call.name.value);
+        // Check argument types
+        for (uint32_t j = 0; j < sig.arity; j++) {
+            TokenType expected = kv_A(*g->m_param_types, sig.params + j);
+            TokenType actual = ast_tok(g->m_prog, ast_list_at(g->m_prog, stmt->as.func_call.args, j)).type;
+            if (!check_types(expected, actual)) {
+                printf("error: type mismatch in argument %u when calling function '%s'\n",
+                    j + 1, token_value(ast_tok(g->m_prog, stmt->as.func_call.name)));
                 exit(1);
             }
-
-                // Check argument types
-            for (int j = 0; j < kv_size(arg.arg_types); j++) {
-                TokenType expected = kv_A(arg.arg_types, j);
-                TokenType actual = kv_A(stmt->as.func_call.args, j).type;
-                if (!check_types(expected, actual)) {
-                    printf("error: type mismatch in argument %d when calling function '%s'\n",
-                        j + 1, stmt->as.func_call.name.value);
-                    exit(1);
-                }
-            }
-
-            }
+        }
         size_t arg_size;
         const char *reg_part = NULL;
-        for (int i = 0; i < kv_size(stmt->as.func_call.args); i ++) {
-            switch (kv_A(stmt->as.func_call.args, i).type) {
+        for (uint32_t i = 0; i < stmt->as.func_call.args.count; i ++) {
+            Token arg = ast_tok(g->m_prog, ast_list_at(g->m_prog, stmt->as.func_call.args, i));
+            switch (arg.type) {
                 case token_type_char_v:  arg_size = 1; break;
                 case token_type_short:   arg_size = 2; break;
                 case token_type_int_lit: arg_size = 4; break;
                 case token_type_long:    arg_size = 8; break;
-                default:                 arg_size = 8; printf("the type is: %d\n",kv_A(stmt->as.func_call.args, i).type); break;
+                default:                 arg_size = 8; printf("the type is: %d\n",arg.type); break;
             }
 
 
@@ -322,112 +305,115 @@ void gen_stmt(gen_data* g, const NodeStmt* stmt) {
                     }
                     break;
             }
-            emit(g, "   mov %s, %d\n", src_reg,atoi(kv_A(stmt->as.func_call.args, i).value));
+            emit(g, "   mov %s, %lld\n", src_reg, (long long)arg.lit);
         }
         emit(g, "   sub rsp,8\n");
-        emit(g, "   call _%s\n",stmt->as.func_call.name.value);
+        emit(g, "   call _%s\n",token_value(ast_tok(g->m_prog, stmt->as.func_call.name)));
         emit(g, "   add rsp,8\n");
-        return;
+        return 0;
     }
 
     if (stmt->kind == NODE_STMT_EXIT) {
-        gen_expr_to_rax(g, &stmt->as.exit_.expr, stmt);
+        gen_expr_to_rax(g, stmt->as.exit_.expr, stmt);
         emit(g, "   mov rdi, rax\n");
         emit(g, "   mov rax, 60\n");
         emit(g, "   syscall\n");
-        return;
+        return 0;
     }
 
     if (stmt->kind == NODE_STMT_IF) {
         // evaluate condition -> rax ; test ; je skip
-        gen_expr_to_rax(g, &stmt->as.if_.cond, stmt);
+        gen_expr_to_rax(g, stmt->as.if_.cond, stmt);
         emit(g, "   test rax, rax\n");
         int id = next_label();
         emit(g, "   je .L_if_end_%d\n", id);
         // body
-        StrVec row;
-        kv_init(row);
-        kv_push(StrVec, *g->m_block, row);
-        for (size_t i = 0; i < kv_size(stmt->as.if_.body); ++i) {
-            gen_stmt(g, &kv_A(stmt->as.if_.body, i));
-        }
-        delete_local_var(g);
-        remove_last_block(g);
-        emit(g, ".L_if_end_%d:\n", id);
-        return;
+        enter_scope(g);
+        return id;
     }
     if (stmt->kind == NODE_STMT_ELSE) {
         int id = next_label();
-        StrVec row;
-        kv_init(row);
-        kv_push(StrVec, *g->m_block, row);
-        for (size_t i = 0; i < kv_size(stmt->as.else_.body); ++i) {
-            gen_stmt(g, &kv_A(stmt->as.else_.body, i));
-        }
-        delete_local_var(g);
-        remove_last_block(g);
-        emit(g, ".L_else_end_%d:\n", id);
-        return;
+        enter_scope(g);
+        return id;
     }
     if (stmt->kind == NODE_STMT_WHILE) {
         int id = next_label();
         emit(g, ".L_While_start_%d:\n", id);
-        gen_expr_to_rax(g, &stmt->as.while_.cond, stmt);
+        gen_expr_to_rax(g, stmt->as.while_.cond, stmt);
         emit(g, "   mov r10, rax\n");
         emit(g, "   test r10, r10\n");
         emit(g, "   je .L_While_end_%d\n", id);
-        StrVec row;
-        kv_init(row);
-        kv_push(StrVec, *g->m_block, row);
-        for (size_t i = 0; i < kv_size(stmt->as.while_.body); ++i) {
-            gen_stmt(g, &kv_A(stmt->as.while_.body, i));
-        }
-        delete_local_var(g);
-        remove_last_block(g);
-
-        // Jump back to start
-        emit(g, "   jmp .L_While_start_%d\n", id);
-
-        // End label
-        emit(g, ".L_While_end_%d:\n", id);
-
-        return;
+        enter_scope(g);
+        return id;
     }
     if (stmt->kind == NODE_STMT_FOR) {
         int id = next_label();
 
+        // the loop variable is scoped to the loop, init and step included
+        enter_scope(g);
+
         // --- init ---
-        gen_stmt(g, stmt->as.for_.cond1); // e.g., i = 0
+        gen_stmt(g, ast_stmt(g->m_prog, stmt->as.for_.cond1)); // e.g., i = 0
 
         emit(g, ".L_For_start_%d:\n", id);
 
-        gen_expr_to_rax(g, &stmt->as.for_.cond2, stmt);  
+        gen_expr_to_rax(g, stmt->as.for_.cond2, stmt);  
 
         emit(g, "   cmp rax, 0\n");        // compare to 0
         emit(g, "   je .L_For_end_%d\n", id);  // exit if false
 
-        StrVec row;
-        kv_init(row);
-        kv_push(StrVec, *g->m_block, row);
-        for (size_t i = 0; i < kv_size(stmt->as.for_.body); ++i) {
-            gen_stmt(g, &kv_A(stmt->as.for_.body, i));
-        }
-        delete_local_var(g);
-        remove_last_block(g);
+        return id;
+    }
 
-    
-        gen_stmt(g, stmt->as.for_.cond3);
+    printf("unkown stmt kind %d\n", stmt->kind);
+    exit(1);
+}
+
+static void gen_stmt_leave(void* ctx, const NodeStmt* stmt, int id) {
+    gen_data* g = ctx;
+    switch (stmt->kind) {
+        case NODE_STMT_FUNC:
+            emit(g, "   leave\n");
+            emit(g, "   ret\n");
+            emit(g,"_placeholder%d:\n", id);
+            leave_scope(g);
+            break;
+        case NODE_STMT_IF:
+            leave_scope(g);
+            emit(g, ".L_if_end_%d:\n", id);
+            break;
+        case NODE_STMT_ELSE:
+            leave_scope(g);
+            emit(g, ".L_else_end_%d:\n", id);
+            break;
+        case NODE_STMT_WHILE:
+            leave_scope(g);
+
+            // Jump back to start
+            emit(g, "   jmp .L_While_start_%d\n", id);
 
-        // --- jump back ---
-        emit(g, "   jmp .L_For_start_%d\n", id);
+            // End label
+            emit(g, ".L_While_end_%d:\n", id);
+            break;
+        case NODE_STMT_FOR:
+            gen_stmt(g, ast_stmt(g->m_prog, stmt->as.for_.cond3));
+
+            // --- jump back ---
+            emit(g, "   jmp .L_For_start_%d\n", id);
+            leave_scope(g);
 
-        // --- end label ---
-        emit(g, ".L_For_end_%d:\n", id);
-        return;
+            // --- end label ---
+            emit(g, ".L_For_end_%d:\n", id);
+            break;
+        default:
+            break;
     }
+}
 
-    printf("unkown stmt kind %d\n", stmt->kind);
-    exit(1);
+static const StmtPass gen_stmt_pass = { walk_body_child, gen_stmt_enter, gen_stmt_leave };
+
+void gen_stmt(gen_data* g, const NodeStmt* stmt) {
+    walk_stmt(g->m_prog, stmt, &gen_stmt_pass, g);
 }
 
 
@@ -443,42 +429,35 @@ gen_data* generate_gen_data(const NodeProg* root) {
     g->m_prog = root;
     g->m_stack_pos = 0;
     g->m_output = sdsempty();
-    g->m_block = malloc(sizeof(Str2DVec));
+    g->m_block = malloc(sizeof(IntVec));
     kv_init(*g->m_block);
 
     g->m_vars = malloc(sizeof(StackVec));
-    kv_init(*g->m_vars);
     if (!g->m_vars) { free(g); return NULL; }
+    kv_init(*g->m_vars);
+    g->m_var_slots = var_map_init();
 
-    g->m_func = malloc(sizeof(func_args));
-    kv_init(*g->m_func);
-
-    // 1) collect var keys
-    collect_vars(root, g);
-
-    // 2) assign slots deterministically in source order (including nested lets)
-    int next_slot = 0;
-    for (size_t i = 0; i < kv_size(root->stmt); ++i) {
-        assign_slots_in_stmt(&kv_A(root->stmt, i),g);
-    }
+    g->m_funcs = func_map_init();
+    g->m_param_types = malloc(sizeof(IntVec));
+    kv_init(*g->m_param_types);
+    // calls may come before the function they call
+    declare_funcs(g);
 
-    int slots = next_slot;
+    // every frame is laid out before any code, the prologues reserve it in one go
+    frame_layout(root, &g->m_frame);
+    int bytes = g->m_frame.main_size;
 
-    // Compute bytes to reserve on stack: slots * 8, round up to 16 for alignment
-    int bytes = slots * 8;
-    if (bytes > 0) {
-        // round up to multiple of 16
-        bytes = ((bytes + 15) / 16) * 16;
-    }
     // Emit prologue
     emit(g, "global _start\n");
     emit(g, "_start:\n");
     emit(g, "   push rbp\n");
     emit(g, "   mov rbp, rsp\n");
     if (bytes > 0) emit(g, "   sub rsp, %d\n", bytes);
-    // Generate code for statements
-    for (size_t i = 0; i < kv_size(root->stmt); ++i) {
-        gen_stmt(g, &kv_A(root->stmt, i));
+    // Generate code for statements, functions nothing calls were never parsed
+    for (uint32_t i = 0; i < root->stmt.count; ++i) {
+        const NodeStmt* stmt = ast_stmt(root, ast_list_at(root, root->stmt, i));
+        if (ast_body_pending(stmt)) continue;
+        walk_stmt(root, stmt, &gen_stmt_pass, g);
     }
     // Note: program usually exits via syscall in exit statements; if not, we still syscall(60) with rdi=0
     emit(g, "   mov rax, 60\n");
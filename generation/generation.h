@@ -2,6 +2,8 @@
 
 #include "../libs/sds.h"
 #include "../parser/parser.h"
+#include "../libs/khashl.h"
+#include "frame/frame.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -18,28 +20,39 @@ typedef struct {
 
 
 typedef struct stack_vars {
-    char* name;
+    Symbol name;
     int type;
+    int offset;   // below rbp, from the frame layout
+    int shadowed; // slot of the same name in an outer block, -1 if none
 } stack_vars;
 
-typedef kvec_t(char*) StrVec;
 typedef kvec_t(int) IntVec;
 typedef kvec_t(stack_vars) StackVec;
-// vector of vector-of-strings
-typedef kvec_t(StrVec) Str2DVec;
-typedef struct args_func {
-    char* name;
-    IntVec arg_types;
-} args_func;
-typedef kvec_t(args_func) func_args;
+
+// interned name -> slot, the index of the variable in m_vars
+KHASHL_MAP_INIT(KH_LOCAL, var_map_t, var_map, Symbol, int, kh_hash_uint32, kh_eq_generic)
+// signature of a top-level function, its parameter types are
+// m_param_types[params .. params + arity)
+typedef struct func_sig {
+    StmtId decl;
+    TokenType ret;
+    uint32_t arity;
+    uint32_t params;
+} func_sig;
+
+// interned name -> signature, every function is in before any code is generated
+KHASHL_MAP_INIT(KH_LOCAL, func_map_t, func_map, Symbol, func_sig, kh_hash_uint32, kh_eq_generic)
 /* gen_data */
 typedef struct gen_data {
     const NodeProg* m_prog;   /* pointer to parsed program */
     size_t m_stack_pos;
     sds m_output;
-    StackVec *m_vars;    // array of all vars
-    Str2DVec *m_block; // for local visibility
-    func_args *m_func;
+    StackVec *m_vars;    // vars in scope, innermost block last
+    var_map_t *m_var_slots; // name -> index of its innermost declaration in m_vars
+    FrameLayout m_frame; // offsets of every variable, see generation/frame
+    IntVec *m_block;     // size of m_vars when each open block was entered
+    func_map_t *m_funcs;     // name -> signature, see declare_funcs()
+    IntVec *m_param_types;   // parameter types of every signature
 } gen_data;
 
 
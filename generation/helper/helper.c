@@ -20,31 +20,11 @@ void emit(gen_data* g, const char* fmt, ...) {
 }
 
 int slot_to_offset(gen_data* g,int slot_index) {
-    int size = 0;
-    for(int i = 0; i <= slot_index; i++) {
-        NodeStmt stmt = kv_A(g->m_prog->stmt, i);
-        switch(stmt.kind) {
-            case NODE_STMT_INT: size+=4; break;
-            case NODE_STMT_CHAR: size +=1; break;
-            case NODE_STMT_SHORT: size +=2; break;
-            case NODE_STMT_LONG: size +=8; break;
-            case NODE_STMT_FUNC:
-                for (int i = 0; i < kv_size(stmt.as.func.types); i++) {
-                    switch (kv_A(stmt.as.func.types, i).pair[0].type) {
-                        case token_type_int:
-                            size+=4; break;
-                        case token_type_short:
-                            size+=2; break;
-                        case token_type_long:
-                            size+=8;break;
-                        case token_type_char_t:
-                            size+=1;break;
-                    }
-                }
-                break;
-        }
+    if (slot_index < 0 || (size_t)slot_index >= kv_size(*g->m_vars)) {
+        fprintf(stderr, "No frame offset for slot %d\n", slot_index);
+        exit(1);
     }
-    return size;
+    return kv_A(*g->m_vars, slot_index).offset;
 }
 int __label_counter = 0;
 int next_label(void) { return __label_counter++; }
@@ -56,22 +36,51 @@ int next_label(void) { return __label_counter++; }
 //   - first pass: create hash entries for every let identifier (keys present and var allocated)
 //   - second pass: assign slot indices (0..n-1) in source-order, including nested lets
 // ------------------------
-void ensure_var_slot(gen_data* g, const char* name, int type) {
-    if (!g || !name) return;
+// ---- Scopes ----
+// m_vars is a stack: declaring a variable pushes it, leaving a block cuts
+// the stack back to where it was when the block was entered. a slot is the
+// position on that stack. the map points at the innermost declaration of a
+// name, the one it hides is kept in the entry and put back on the way out
+void enter_scope(gen_data* g) {
+    kv_push(int, *g->m_block, (int)kv_size(*g->m_vars));
+}
 
-    // Check if the variable already exists
-    for (size_t i = 0; i < kv_size(*g->m_vars); i++) {
-        if (strcmp(kv_A(*g->m_vars, i).name, name) == 0) {
-            return; // already present
-        }
+void leave_scope(gen_data* g) {
+    if (!g || !g->m_block || kv_size(*g->m_block) == 0) {
+        fprintf(stderr, "Error: no open block to leave\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t mark = (size_t)kv_pop(*g->m_block);
+    while (kv_size(*g->m_vars) > mark) {
+        stack_vars v = kv_pop(*g->m_vars);
+        khint_t k = var_map_get(g->m_var_slots, v.name);
+        if (v.shadowed < 0) var_map_del(g->m_var_slots, k);
+        else kh_val(g->m_var_slots, k) = v.shadowed;
+    }
+}
+
+void declare_var(gen_data* g, Symbol name, int type, int offset) {
+    if (!g || name == SYMBOL_NONE) return;
+
+    int absent;
+    khint_t k = var_map_put(g->m_var_slots, name, &absent);
+    int outer = absent ? -1 : kh_val(g->m_var_slots, k);
+    int mark = kv_size(*g->m_block) ? kv_A(*g->m_block, kv_size(*g->m_block) - 1) : 0;
+    if (outer >= mark) {
+        // declared again in the same block: same slot, but the new declaration's
+        // type and the bytes the frame layout gave it
+        stack_vars* v = &kv_A(*g->m_vars, outer);
+        v->type = type;
+        v->offset = offset;
+        return;
     }
 
-    // Variable not found, add new slot
     stack_vars sv;
-    sv.name = strdup(name);
+    sv.name = name;
     sv.type = type;
-    if (!sv.name) { perror("strdup"); exit(1); }
-
+    sv.offset = offset;
+    sv.shadowed = outer;
+    kh_val(g->m_var_slots, k) = (int)kv_size(*g->m_vars);
     kv_push(stack_vars, *g->m_vars, sv);
 }
 
@@ -103,13 +112,12 @@ bool check_types(TokenType expected, TokenType actual) {
 }
 
 
-int get_type_by_name(gen_data* g, const char* name) {
-    for (size_t i = 0; i < kv_size(*g->m_vars); i++) {
-        if (strcmp(kv_A(*g->m_vars, i).name, name) == 0) {
-            return kv_A(*g->m_vars,i).type;
-        }
+int get_type_by_name(gen_data* g, Symbol name) {
+    khint_t k = var_map_get(g->m_var_slots, name);
+    if (k != kh_end(g->m_var_slots)) {
+        return kv_A(*g->m_vars, kh_val(g->m_var_slots, k)).type;
     }
-    printf("Trying to get type of undefined var: %s\n", name);
+    printf("Trying to get type of undefined var: %s\n", intern_str(name));
     exit(1);
 }
 
@@ -141,177 +149,58 @@ void emit_ident_to_move(gen_data* g, int off, int type) {
     } 
 }
 
-void collect_vars(const NodeProg* prog, gen_data* g) {
-    if (!prog || !g) return;
-    // Walk top-level statements to ensure every let identifier gets an entry in the hash.
-    for (size_t i = 0; i < kv_size(prog->stmt); ++i) {
-        const NodeStmt* s = &kv_A(prog->stmt, i);
-        collect_vars_in_stmt(s, g);
+int lookup_var_slot(gen_data* g, Symbol name) {
+    if (!g || !g->m_vars || name == SYMBOL_NONE) {
+        fprintf(stderr, "Invalid arguments to lookup_var_slot\n");
+        exit(1);
     }
-}
 
-void collect_vars_in_stmt(const NodeStmt* stmt, gen_data* g) {
-    if (!stmt) return;
-    if (stmt->kind == NODE_STMT_INT) {
-        ensure_var_slot(g, stmt->as.int_.ident.value, token_type_int);
-        collect_vars_in_expr(&stmt->as.int_.expr, g);
-    } else if (stmt->kind == NODE_STMT_CHAR) {
-        ensure_var_slot(g, stmt->as.char_.ident.value, token_type_char_t);
-        collect_vars_in_expr(&stmt->as.char_.expr, g);
-    } else if (stmt->kind == NODE_STMT_SHORT) {
-        ensure_var_slot(g, stmt->as.short_.ident.value, token_type_short);
-        collect_vars_in_expr(&stmt->as.short_.expr, g);
-    } else if (stmt->kind == NODE_STMT_LONG) {
-        ensure_var_slot(g, stmt->as.long_.ident.value, token_type_long);
-        collect_vars_in_expr(&stmt->as.long_.expr, g);
-    } else if (stmt->kind == NODE_STMT_EXIT) {
-        collect_vars_in_expr(&stmt->as.exit_.expr, g);
-    } else if (stmt->kind == NODE_STMT_IF) {
-        collect_vars_in_expr(&stmt->as.if_.cond, g);
-        for (size_t i = 0; i < kv_size(stmt->as.if_.body); ++i) {
-            collect_vars_in_stmt(&kv_A(stmt->as.if_.body, i), g);
-        }
-    } else if (stmt->kind == NODE_STMT_FOR) {
-        collect_vars_in_stmt(stmt->as.for_.cond1,g);    
+    khint_t k = var_map_get(g->m_var_slots, name);
+    if (k != kh_end(g->m_var_slots)) {
+        return kh_val(g->m_var_slots, k);  // index in the array is the slot
     }
-}
-
 
-
-
-void collect_vars_in_expr(const NodeExpr* expr, gen_data* g) {
-    if (!expr) return;
-    if (expr->kind == NODE_EXPR_INT_LIT) return;
-    if (expr->kind == NODE_EXPR_IDENT) {
-        // usage of an identifier doesn't implicitly create a "let"; we do not call ensure_var_slot here
-        // to preserve the generator's behavior (undefined variable at codegen should be an error later).
-        return;
-    }
-    if (expr->kind == NODE_EXPR_BIN) {
-        const BinExpr* b = expr->as.bin;
-        if (!b) return;
-        switch (b->kind) {
-            case BIN_EXPR_ADD:
-                if (b->as.add.lhs.type == NODE_EXPR) collect_vars_in_expr(b->as.add.lhs.as.node_expr, g);
-                if (b->as.add.rhs.type == NODE_EXPR) collect_vars_in_expr(b->as.add.rhs.as.node_expr, g);
-                if (b->as.add.lhs.type == BIN_EXPR) collect_vars_in_expr(&(NodeExpr){ .kind = NODE_EXPR_BIN, .as = { .bin = b->as.add.lhs.as.bin_expr } }, g);
-                if (b->as.add.rhs.type == BIN_EXPR) collect_vars_in_expr(&(NodeExpr){ .kind = NODE_EXPR_BIN, .as = { .bin = b->as.add.rhs.as.bin_expr } }, g);
-                break;
-            case BIN_EXPR_MINUS:
-                if (b->as.minus.lhs.type == NODE_EXPR) collect_vars_in_expr(b->as.minus.lhs.as.node_expr, g);
-                if (b->as.minus.rhs.type == NODE_EXPR) collect_vars_in_expr(b->as.minus.rhs.as.node_expr, g);
-                if (b->as.minus.lhs.type == BIN_EXPR) collect_vars_in_expr(&(NodeExpr){ .kind = NODE_EXPR_BIN, .as = { .bin = b->as.minus.lhs.as.bin_expr } }, g);
-                if (b->as.minus.rhs.type == BIN_EXPR) collect_vars_in_expr(&(NodeExpr){ .kind = NODE_EXPR_BIN, .as = { .bin = b->as.minus.rhs.as.bin_expr } }, g);
-                break;
-            case BIN_EXPR_MULTI:
-                if (b->as.multi.lhs.type == NODE_EXPR) collect_vars_in_expr(b->as.multi.lhs.as.node_expr, g);
-                if (b->as.multi.rhs.type == NODE_EXPR) collect_vars_in_expr(b->as.multi.rhs.as.node_expr, g);
-                if (b->as.multi.lhs.type == BIN_EXPR) collect_vars_in_expr(&(NodeExpr){ .kind = NODE_EXPR_BIN, .as = { .bin = b->as.multi.lhs.as.bin_expr } }, g);
-                if (b->as.multi.rhs.type == BIN_EXPR) collect_vars_in_expr(&(NodeExpr){ .kind = NODE_EXPR_BIN, .as = { .bin = b->as.multi.rhs.as.bin_expr } }, g);
-                break;
-            case BIN_EXPR_DIVIDE:
-                if (b->as.divide.lhs.type == NODE_EXPR) collect_vars_in_expr(b->as.divide.lhs.as.node_expr, g);
-                if (b->as.divide.rhs.type == NODE_EXPR) collect_vars_in_expr(b->as.divide.rhs.as.node_expr, g);
-                if (b->as.divide.lhs.type == BIN_EXPR) collect_vars_in_expr(&(NodeExpr){ .kind = NODE_EXPR_BIN, .as = { .bin = b->as.divide.lhs.as.bin_expr } }, g);
-                if (b->as.divide.rhs.type == BIN_EXPR) collect_vars_in_expr(&(NodeExpr){ .kind = NODE_EXPR_BIN, .as = { .bin = b->as.divide.rhs.as.bin_expr } }, g);
-                break;
-            default:
-                if (b->as.binop.lhs.type == NODE_EXPR) collect_vars_in_expr(b->as.binop.lhs.as.node_expr, g);
-                if (b->as.binop.rhs.type == NODE_EXPR) collect_vars_in_expr(b->as.binop.rhs.as.node_expr, g);
-                if (b->as.binop.lhs.type == BIN_EXPR) collect_vars_in_expr(&(NodeExpr){ .kind = NODE_EXPR_BIN, .as = { .bin = b->as.binop.lhs.as.bin_expr } }, g);
-                if (b->as.binop.rhs.type == BIN_EXPR) collect_vars_in_expr(&(NodeExpr){ .kind = NODE_EXPR_BIN, .as = { .bin = b->as.binop.rhs.as.bin_expr } }, g);
-                break;
-        }
-    }
+    fprintf(stderr, "Undefined variable at codegen: %s\n", intern_str(name));
+    exit(1);
 }
 
-
-void assign_slots_in_stmt(const NodeStmt* stmt, gen_data* g) {
-    if (!stmt || !g) return;
-    if (stmt->kind == NODE_STMT_SHORT) {
-        ensure_var_slot(g, stmt->as.short_.ident.value, token_type_short);
-        collect_vars_in_expr(&stmt->as.short_.expr, g);
-    }
-    if (stmt->kind == NODE_STMT_LONG) {
-        ensure_var_slot(g, stmt->as.long_.ident.value, token_type_long);
-        collect_vars_in_expr(&stmt->as.long_.expr, g);
-    }
-    if (stmt->kind == NODE_STMT_INT) {
-        ensure_var_slot(g, stmt->as.int_.ident.value, token_type_int);
-        collect_vars_in_expr(&stmt->as.int_.expr, g);
-
-    } else if (stmt->kind == NODE_STMT_CHAR) {
-        ensure_var_slot(g, stmt->as.char_.ident.value, token_type_char_t);
-        collect_vars_in_expr(&stmt->as.char_.expr, g);
-
-    } else if (stmt->kind == NODE_STMT_EXIT) {
-        collect_vars_in_expr(&stmt->as.exit_.expr, g);
-
-    } else if (stmt->kind == NODE_STMT_IF) {
-        for (size_t i = 0; i < kv_size(stmt->as.if_.body); ++i) {
-            assign_slots_in_stmt(&kv_A(stmt->as.if_.body, i), g);
-        }
-    } else if (stmt->kind == NODE_STMT_FUNC) {
-        for (size_t i = 0; i < kv_size(stmt->as.func.body); ++i) {
-            assign_slots_in_stmt(&kv_A(stmt->as.func.body, i), g);
+// ---- Functions ----
+// one signature per top-level function, pending bodies included: their
+// header is parsed, and a call checks against the header only
+void declare_funcs(gen_data* g) {
+    const NodeProg* prog = g->m_prog;
+    for (uint32_t i = 0; i < prog->stmt.count; i++) {
+        StmtId id = ast_list_at(prog, prog->stmt, i);
+        const NodeStmt* stmt = ast_stmt(prog, id);
+        if (stmt->kind != NODE_STMT_FUNC) continue;
+
+        Token name = ast_tok(prog, stmt->as.func.name);
+        int absent;
+        khint_t k = func_map_put(g->m_funcs, name.sym, &absent);
+        if (!absent) {
+            fprintf(stderr, "error: function '%s' defined more than once\n", intern_str(name.sym));
+            exit(1);
         }
 
-    } else if (stmt->kind == NODE_STMT_FOR) {
-        if (stmt->as.for_.cond1)
-            assign_slots_in_stmt(stmt->as.for_.cond1, g);
-        if (stmt->as.for_.cond3)
-            assign_slots_in_stmt(stmt->as.for_.cond3, g);
-        for (size_t i = 0; i < kv_size(stmt->as.for_.body); ++i) {
-            assign_slots_in_stmt(&kv_A(stmt->as.for_.body, i), g);
+        func_sig sig;
+        sig.decl = id;
+        sig.ret = ast_tok(prog, stmt->as.func.ExpectedReturnType).type;
+        sig.arity = stmt->as.func.types.count / 2;
+        sig.params = (uint32_t)kv_size(*g->m_param_types);
+        for (uint32_t j = 0; j < sig.arity; j++) {
+            TokId type = ast_list_at(prog, stmt->as.func.types, 2 * j);
+            kv_push(int, *g->m_param_types, ast_tok(prog, type).type);
         }
+        kh_val(g->m_funcs, k) = sig;
     }
 }
 
-
-int lookup_var_slot(gen_data* g, const char* name) {
-    if (!g || !g->m_vars || !name) {
-        fprintf(stderr, "Invalid arguments to lookup_var_slot\n");
-        exit(1);
-    }
-
-    StackVec* vars = g->m_vars;
-    for (size_t i = 0; i < kv_size(*vars); i++) {
-        if (strcmp(kv_A(*vars, i).name, name) == 0) {
-            return (int)i;  // index in the array is the slot
-        }
-    }
-
-    fprintf(stderr, "Undefined variable at codegen: %s\n", name);
-    exit(1);
-}
-
-// Evaluate a BindExprRec into rax
-
-void gen_bindexpr_to_rax(gen_data* g, const BindExprRec rec, NodeStmt* stmt) {
-    if (rec.type == NODE_EXPR) {
-        NodeExpr* n = rec.as.node_expr;
-        if (!n) { emit(g, "   ; gen: NULL node\n"); return; }
-        if (n->kind == NODE_EXPR_INT_LIT) {
-            emit(g, "   mov eax, %s\n", n->as.int_lit.int_lit.value);
-            return;
-        } else if (n->kind == NODE_EXPR_IDENT) {
-            int slot = lookup_var_slot(g, n->as.ident.ident.value);
-            int off = slot_to_offset(g,slot);
-            emit_move_to_ident(g, off,stmt);
-            return;
-        } else if (n->kind == NODE_EXPR_BIN && n->as.bin) {
-            gen_binexpr_to_rax(g, n->as.bin, stmt);
-            return;
-        } else {
-            emit(g, "   ; gen: unsupported node kind %d\n", n->kind);
-            return;
-        }
-    } else if (rec.type == BIN_EXPR) {
-        gen_binexpr_to_rax(g, rec.as.bin_expr, stmt);
-        return;
-    } else {
-        emit(g, "   ; gen: unknown BindExprRec.type %d\n", rec.type);
-    }
+// copies the signature out, buckets of the map are packed
+bool lookup_func(gen_data* g, Symbol name, func_sig* out) {
+    khint_t k = func_map_get(g->m_funcs, name);
+    if (k == kh_end(g->m_funcs)) return false;
+    *out = kh_val(g->m_funcs, k);
+    return true;
 }
 
 RegPair get_regpair_for_stmt(int type) {
@@ -323,128 +212,146 @@ RegPair get_regpair_for_stmt(int type) {
         default:              printf("unkown token kind: %d\n",type);  return (RegPair){ "??",  "??"  };
     }
 }
-// Evaluate a BinExpr (pointer) into rax
-void gen_binexpr_to_rax(gen_data* g, const BinExpr* b, NodeStmt* stmt) {
-    if (!b) return;
-
-    BindExprRec lhs, rhs;
-    switch (b->kind) {
-        case BIN_EXPR_ADD:    lhs = b->as.add.lhs;    rhs = b->as.add.rhs;    break;
-        case BIN_EXPR_MINUS:  lhs = b->as.minus.lhs;  rhs = b->as.minus.rhs;  break;
-        case BIN_EXPR_MULTI:  lhs = b->as.multi.lhs;  rhs = b->as.multi.rhs;  break;
-        case BIN_EXPR_DIVIDE: lhs = b->as.divide.lhs; rhs = b->as.divide.rhs; break;
-        default:              lhs = b->as.binop.lhs; rhs = b->as.binop.rhs;   break;
+// Evaluate an operand of a binary expression into rax
+static void gen_operand_to_rax(gen_data* g, ExprId id, NodeStmt* stmt) {
+    const NodeExpr* n = ast_expr(g->m_prog, id);
+    if (n->kind == NODE_EXPR_INT_LIT) {
+        emit(g, "   mov eax, %lld\n", (long long)ast_tok(g->m_prog, n->as.int_lit.int_lit).lit);
+    } else if (n->kind == NODE_EXPR_IDENT) {
+        int slot = lookup_var_slot(g, ast_tok(g->m_prog, n->as.ident.ident).sym);
+        int off = slot_to_offset(g,slot);
+        emit_move_to_ident(g, off,stmt);
+    } else if (n->kind == NODE_EXPR_CHAR) {
+        emit(g, "   mov eax, %d\n", (int)ast_tok(g->m_prog, n->as.char_.char_).lit);
+    } else if (n->kind == NODE_EXPR_FUNC) {
+        gen_expr_to_rax(g, id, stmt); // return value comes back in rax
+    } else {
+        emit(g, "   ; gen: unsupported node kind %d\n", n->kind);
     }
+}
 
-    // Arithmetic operations
-    if (b->kind == BIN_EXPR_ADD || b->kind == BIN_EXPR_MINUS ||
-        b->kind == BIN_EXPR_MULTI || b->kind == BIN_EXPR_DIVIDE) {
-        RegPair reg;
-        if (stmt->kind == NODE_STMT_VCHANGE) {
-            int type = get_type_by_name(g, stmt->as.vchange.ident.value);
-            reg = get_regpair_for_stmt(type);
-        } else {
-            reg = (RegPair){ "rbx", "rax" };
-        }
-        gen_bindexpr_to_rax(g, lhs,stmt);     // lhs -> rax
-        emit(g, "   push rax\n");
-        gen_bindexpr_to_rax(g, rhs,stmt); 
-        emit(g, "   mov %s, %s\n",reg.dst,reg.src);
-        emit(g, "   pop rax\n");         // rax = lhs
-
-        switch (b->kind) {
-            case BIN_EXPR_ADD:   emit(g, "   add rax, rbx\n"); break;
-            case BIN_EXPR_MINUS:  emit(g, "   sub rax, rbx\n"); break;
-            case BIN_EXPR_MULTI:  emit(g, "   imul rax, rbx\n"); break;
-            case BIN_EXPR_DIVIDE: emit(g, "   cqo\n   idiv rbx\n"); break;
-            default: break;
+// Evaluate a binary expression into rax from its postfix code.
+// the value on top lives in rax, the ones below it on the machine stack
+void gen_rpn_to_rax(gen_data* g, ExprId root, NodeStmt* stmt) {
+    const NodeProg* prog = g->m_prog;
+    AstList code = ast_expr_code(prog, root);
+    IntVec labels; // one per && / || whose right side is being evaluated
+    kv_init(labels);
+    bool rax_live = false;
+
+    for (uint32_t i = 0; i < code.count; i++) {
+        const RpnOp* op = &kv_A(prog->rpn, code.start + i);
+        BinExprKind kind = (BinExprKind)op->op;
+
+        if (op->kind == RPN_OPERAND) {
+            if (rax_live) emit(g, "   push rax\n");
+            gen_operand_to_rax(g, op->expr, stmt);
+            rax_live = true;
+            continue;
         }
-        return;
-    }
 
-    // Comparisons -> 0/1 in rax
-    if (b->kind == BIN_EXPR_EQ || b->kind == BIN_EXPR_NEQ ||
-        b->kind == BIN_EXPR_LT || b->kind == BIN_EXPR_LTE ||
-        b->kind == BIN_EXPR_MR || b->kind == BIN_EXPR_MRE) {
-
-        gen_bindexpr_to_rax(g, lhs,stmt);
-        emit(g, "   push rax\n");
-        gen_bindexpr_to_rax(g, rhs,stmt);
-        emit(g, "   mov rbx, rax\n");
-        emit(g, "   pop rax\n");
-        emit(g, "   cmp rax, rbx\n");
-
-        switch (b->kind) {
-            case BIN_EXPR_EQ:  emit(g, "   sete al\n"); break;
-            case BIN_EXPR_NEQ: emit(g, "   setne al\n"); break;
-            case BIN_EXPR_LT:  emit(g, "   setl al\n"); break;
-            case BIN_EXPR_LTE: emit(g, "   setle al\n"); break;
-            case BIN_EXPR_MR:  emit(g, "   setg al\n"); break;
-            case BIN_EXPR_MRE: emit(g, "   setge al\n"); break;
-            default: break;
+        if (op->kind == RPN_BRANCH) {
+            // the left side is consumed by the test, the right side starts fresh
+            int id = next_label();
+            kv_push(int, labels, id);
+            emit(g, "   test rax, rax\n");
+            if (kind == BIN_EXPR_AND) emit(g, "   je .L_and_false_%d\n", id);
+            else                      emit(g, "   jne .L_or_true_%d\n", id);
+            rax_live = false;
+            continue;
         }
-        emit(g, "   movzx rax, al\n");
-        return;
-    }
-
-    // Logical AND / OR with short-circuit
-    if (b->kind == BIN_EXPR_AND || b->kind == BIN_EXPR_OR) {
-        int id = next_label();
-        gen_bindexpr_to_rax(g, lhs,stmt);
-        emit(g, "   test rax, rax\n");
 
-        if (b->kind == BIN_EXPR_AND) {
-            emit(g, "   je .L_and_false_%d\n", id);
-            gen_bindexpr_to_rax(g, rhs,stmt);
-            emit(g, "   test rax, rax\n");
-            emit(g, "   setne al\n");
+        // Arithmetic operations
+        if (kind == BIN_EXPR_ADD || kind == BIN_EXPR_MINUS ||
+            kind == BIN_EXPR_MULTI || kind == BIN_EXPR_DIVIDE) {
+            RegPair reg;
+            if (stmt->kind == NODE_STMT_VCHANGE) {
+                int type = get_type_by_name(g, ast_tok(prog, stmt->as.vchange.ident).sym);
+                reg = get_regpair_for_stmt(type);
+            } else {
+                reg = (RegPair){ "rbx", "rax" };
+            }
+            emit(g, "   mov %s, %s\n",reg.dst,reg.src);
+            emit(g, "   pop rax\n");         // rax = lhs
+
+            switch (kind) {
+                case BIN_EXPR_ADD:   emit(g, "   add rax, rbx\n"); break;
+                case BIN_EXPR_MINUS:  emit(g, "   sub rax, rbx\n"); break;
+                case BIN_EXPR_MULTI:  emit(g, "   imul rax, rbx\n"); break;
+                case BIN_EXPR_DIVIDE: emit(g, "   cqo\n   idiv rbx\n"); break;
+                default: break;
+            }
+        }
+        // Comparisons -> 0/1 in rax
+        else if (kind == BIN_EXPR_EQ || kind == BIN_EXPR_NEQ ||
+                 kind == BIN_EXPR_LT || kind == BIN_EXPR_LTE ||
+                 kind == BIN_EXPR_MR || kind == BIN_EXPR_MRE) {
+            emit(g, "   mov rbx, rax\n");
+            emit(g, "   pop rax\n");
+            emit(g, "   cmp rax, rbx\n");
+
+            switch (kind) {
+                case BIN_EXPR_EQ:  emit(g, "   sete al\n"); break;
+                case BIN_EXPR_NEQ: emit(g, "   setne al\n"); break;
+                case BIN_EXPR_LT:  emit(g, "   setl al\n"); break;
+                case BIN_EXPR_LTE: emit(g, "   setle al\n"); break;
+                case BIN_EXPR_MR:  emit(g, "   setg al\n"); break;
+                case BIN_EXPR_MRE: emit(g, "   setge al\n"); break;
+                default: break;
+            }
             emit(g, "   movzx rax, al\n");
-            emit(g, "   jmp .L_and_end_%d\n", id);
-            emit(g, ".L_and_false_%d:\n", id);
-            emit(g, "   mov rax, 0\n");
-            emit(g, ".L_and_end_%d:\n", id);
-        } else { // OR
-            emit(g, "   jne .L_or_true_%d\n", id);
-            gen_bindexpr_to_rax(g, rhs,stmt);
+        }
+        // Logical AND / OR, the right side is in rax
+        else if (kind == BIN_EXPR_AND || kind == BIN_EXPR_OR) {
+            int id = kv_pop(labels);
             emit(g, "   test rax, rax\n");
             emit(g, "   setne al\n");
             emit(g, "   movzx rax, al\n");
-            emit(g, "   jmp .L_or_end_%d\n", id);
-            emit(g, ".L_or_true_%d:\n", id);
-            emit(g, "   mov rax, 1\n");
-            emit(g, ".L_or_end_%d:\n", id);
+            if (kind == BIN_EXPR_AND) {
+                emit(g, "   jmp .L_and_end_%d\n", id);
+                emit(g, ".L_and_false_%d:\n", id);
+                emit(g, "   mov rax, 0\n");
+                emit(g, ".L_and_end_%d:\n", id);
+            } else {
+                emit(g, "   jmp .L_or_end_%d\n", id);
+                emit(g, ".L_or_true_%d:\n", id);
+                emit(g, "   mov rax, 1\n");
+                emit(g, ".L_or_end_%d:\n", id);
+            }
+        } else {
+            emit(g, "   ; gen_rpn_to_rax: unhandled kind %d\n", kind);
         }
-        return;
+        rax_live = true;
     }
-
-    emit(g, "   ; gen_binexpr_to_rax: unhandled kind %d\n", b->kind);
+    kv_destroy(labels);
 }
 
 void emit_move_to_int_lit(gen_data* g, const NodeExpr* expr, NodeStmt* stmt) {
     if (stmt->kind == NODE_STMT_INT) {
-        emit(g, "   mov eax, %s\n", expr->as.int_lit.int_lit.value);
+        emit(g, "   mov eax, %lld\n", (long long)ast_tok(g->m_prog, expr->as.int_lit.int_lit).lit);
     } else if (stmt->kind == NODE_STMT_CHAR) {
-        emit(g, "   mov al, %s\n", expr->as.char_.char_.value);
+        emit(g, "   mov al, %lld\n", (long long)ast_tok(g->m_prog, expr->as.char_.char_).lit);
     } else if (stmt->kind == NODE_STMT_SHORT) {
-        emit(g, "   mov ax, %s\n", expr->as.char_.char_.value);
+        emit(g, "   mov ax, %lld\n", (long long)ast_tok(g->m_prog, expr->as.char_.char_).lit);
     } else if (stmt->kind == NODE_STMT_LONG) {
-        emit(g, "   mov rax, %s\n", expr->as.char_.char_.value);
+        emit(g, "   mov rax, %lld\n", (long long)ast_tok(g->m_prog, expr->as.char_.char_).lit);
     }
 }
 
 
 // Evaluate NodeExpr (result in rax)    
-void gen_expr_to_rax(gen_data* g, const NodeExpr* expr, NodeStmt* stmt) {
-    if (expr->kind == NODE_EXPR_EMPTY) { emit(g, "   ; gen_expr: NULL\n"); return; }
+void gen_expr_to_rax(gen_data* g, ExprId id, NodeStmt* stmt) {
+    const NodeExpr* expr = ast_expr(g->m_prog, id);
+    if (!expr || expr->kind == NODE_EXPR_EMPTY) { emit(g, "   ; gen_expr: NULL\n"); return; }
 
     if (expr->kind == NODE_EXPR_FUNC) {
-        NodeStmt *res = malloc(sizeof(NodeStmt));
+        NodeStmt res;
         NodeStmtFunCall help;
         help.args = expr->as.func.args;
         help.name = expr->as.func.name;
-        res->kind = NODE_STMT_FUNC_USE;
-        res->as.func_call = help;
-        gen_stmt(g, res);
+        res.kind = NODE_STMT_FUNC_USE;
+        res.as.func_call = help;
+        gen_stmt(g, &res);
         return;
     }
 
@@ -452,13 +359,13 @@ void gen_expr_to_rax(gen_data* g, const NodeExpr* expr, NodeStmt* stmt) {
         emit_move_to_int_lit(g, expr,stmt);
         return;
     } else if (expr->kind == NODE_EXPR_IDENT) {
-        int slot = lookup_var_slot(g, expr->as.ident.ident.value);
+        int slot = lookup_var_slot(g, ast_tok(g->m_prog, expr->as.ident.ident).sym);
         int off = slot_to_offset(g,slot);
         emit_move_to_ident(g,off,stmt);
         // the func arg
         if (stmt->kind == NODE_STMT_FUNC) {
-            for (int i = 0; i < kv_size(stmt->as.func.types); i++) {
-                char* type = kv_A(stmt->as.func.types, i).pair[0].value;
+            for (uint32_t i = 0; i < stmt->as.func.types.count / 2; i++) {
+                const char* type = token_value(ast_tok(g->m_prog, ast_list_at(g->m_prog, stmt->as.func.types, 2 * i)));
 
                 switch (i) {
                     case 0: emit(g, "  mov edi, dword [%s]\n", type); break;
@@ -477,81 +384,13 @@ void gen_expr_to_rax(gen_data* g, const NodeExpr* expr, NodeStmt* stmt) {
         }
         return;
     } else if (expr->kind == NODE_EXPR_BIN) {
-        gen_binexpr_to_rax(g, expr->as.bin, stmt);
+        gen_rpn_to_rax(g, id, stmt);
         return;
     } else if (expr->kind == NODE_EXPR_CHAR) {
-        emit(g, "   mov al, %d\n", (int)*expr->as.char_.char_.value);
+        emit(g, "   mov al, %d\n", (int)ast_tok(g->m_prog, expr->as.char_.char_).lit);
         return;
     } else {
         printf("gen_expr: unknown kind %d\n", expr->kind);
         exit(1);
     }
 }
-
-void delete_local_var(gen_data *g) {
-    if (!g || !g->m_block || kv_size(*g->m_block) == 0 || !g->m_vars) {
-        fprintf(stderr, "Error: gen_data or m_block or m_vars is null/empty\n");
-        exit(EXIT_FAILURE);
-    }
-
-    Str2DVec *blocks = g->m_block;
-    size_t last_block_idx = kv_size(*blocks) - 1;
-    StrVec *last_block = &kv_A(*blocks, last_block_idx);
-
-    // Iterate strings in last_block
-    for (size_t i = 0; i < kv_size(*last_block); i++) {
-        char *key = kv_A(*last_block, i);
-
-        // Search for key in StackVec
-        size_t j;
-        int found = 0;
-        for (j = 0; j < kv_size(*g->m_vars); j++) {
-            if (strcmp(kv_A(*g->m_vars, j).name, key) == 0) {
-                found = 1;
-                break;
-            }
-        }
-
-        if (!found) {
-            fprintf(stderr, "Error: key '%s' not found in m_vars\n", key);
-            exit(EXIT_FAILURE);
-        }
-
-        // free name string
-        free(kv_A(*g->m_vars, j).name);
-
-        // remove from StackVec by shifting elements
-        for (size_t k = j; k + 1 < kv_size(*g->m_vars); k++) {
-            kv_A(*g->m_vars, k) = kv_A(*g->m_vars, k + 1);
-        }
-        kv_pop(*g->m_vars); // reduce size by 1
-    }
-
-    // remove the last block
-    kv_pop(*blocks);
-}
-
-
-// removes last block from g->m_block
-void remove_last_block(gen_data *g) {
-    if (!g || !g->m_block || kv_size(*g->m_block) == 0)
-        return; // nothing to remove
-
-    Str2DVec *blocks = g->m_block;
-    size_t last_block_idx = kv_size(*blocks) - 1;
-
-    // Get pointer to the last block (the real one inside the outer vector)
-    StrVec *last_block = &kv_A(*blocks, last_block_idx);
-
-    // Free all strings in the last block
-    for (size_t i = 0; i < kv_size(*last_block); i++) {
-        free(kv_A(*last_block, i));
-    }
-
-    // Destroy the inner vector (pass the actual vector)
-    kv_destroy(*last_block);
-
-    // Remove the last element from outer vector
-    kv_pop(*blocks);
-
-}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "walk.h"
+
+typedef struct WalkFrame {
+    const NodeStmt* stmt;
+    uint32_t next; // children visited so far
+    int state;     // what enter() returned
+} WalkFrame;
+
+bool walk_body_child(const NodeProg* prog, const NodeStmt* stmt, uint32_t i, StmtId* out) {
+    switch (stmt->kind) {
+        case NODE_STMT_IF:    return walk_list_child(prog, stmt->as.if_.body, i, out);
+        case NODE_STMT_ELSE:  return walk_list_child(prog, stmt->as.else_.body, i, out);
+        case NODE_STMT_WHILE: return walk_list_child(prog, stmt->as.while_.body, i, out);
+        case NODE_STMT_FOR:   return walk_list_child(prog, stmt->as.for_.body, i, out);
+        case NODE_STMT_FUNC:  return walk_list_child(prog, stmt->as.func.body, i, out);
+        default:              return false;
+    }
+}
+
+void walk_stmt(const NodeProg* prog, const NodeStmt* root, const StmtPass* pass, void* ctx) {
+    if (!root) return;
+
+    kvec_t(WalkFrame) stack;
+    kv_init(stack);
+    WalkFrame first = { root, 0, pass->enter(ctx, root) };
+    kv_push(WalkFrame, stack, first);
+
+    while (kv_size(stack) > 0) {
+        WalkFrame* top = &kv_A(stack, kv_size(stack) - 1);
+        StmtId id;
+        if (pass->child(prog, top->stmt, top->next, &id)) {
+            top->next++;
+            const NodeStmt* stmt = ast_stmt(prog, id);
+            if (!stmt) continue;
+            WalkFrame frame = { stmt, 0, pass->enter(ctx, stmt) };
+            kv_push(WalkFrame, stack, frame);
+            continue;
+        }
+        WalkFrame done = kv_pop(stack);
+        if (pass->leave) pass->leave(ctx, done.stmt, done.state);
+    }
+
+    kv_destroy(stack);
+}
+
+void walk_stmt_list(const NodeProg* prog, AstList list, const StmtPass* pass, void* ctx) {
+    for (uint32_t i = 0; i < list.count; i++) {
+        walk_stmt(prog, ast_stmt(prog, ast_list_at(prog, list, i)), pass, ctx);
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "../../parser/parser.h"
+#include <stdbool.h>
+
+// ---- Statement walker ----
+// depth first over the statement tree, nested statements are kept on a heap
+// stack instead of the C stack. every pass picks which nested statements it
+// descends into, and gets a call before and after them.
+typedef struct StmtPass {
+    // i-th nested statement of stmt for this pass, false past the last one.
+    // *out may be AST_NONE, that child is skipped
+    bool (*child)(const NodeProg* prog, const NodeStmt* stmt, uint32_t i, StmtId* out);
+    // before the children, the result is handed back to leave()
+    int (*enter)(void* ctx, const NodeStmt* stmt);
+    // after the children, may be NULL
+    void (*leave)(void* ctx, const NodeStmt* stmt, int state);
+} StmtPass;
+
+void walk_stmt(const NodeProg* prog, const NodeStmt* root, const StmtPass* pass, void* ctx);
+void walk_stmt_list(const NodeProg* prog, AstList list, const StmtPass* pass, void* ctx);
+
+static inline bool walk_list_child(const NodeProg* prog, AstList list, uint32_t i, StmtId* out) {
+    if (i >= list.count) return false;
+    *out = ast_list_at(prog, list, i);
+    return true;
+}
+
+// the body of if / else / while / for / function
+bool walk_body_child(const NodeProg* prog, const NodeStmt* stmt, uint32_t i, StmtId* out);
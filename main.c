@@ -1,20 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include "tokenizer/tokenizer.h"
 #include "parser/parser.h"
+#include "parser/cache/cache.h"
 #include "generation/generation.h"
 
 
 
-typedef struct {
-    char *data;
-    size_t size;
-} StringView;
-
 int load_file(const char *filename, StringView *out) {
     int fd = open(filename, O_RDONLY);
     if (fd == -1) {
@@ -50,9 +47,9 @@ int load_file(const char *filename, StringView *out) {
     return EXIT_SUCCESS;
 }
 
-void print_tokens(TokenArray* tokens) {
+void print_tokens(TokenStore* tokens) {
     for (size_t i = 0; i < tokens->n; i++) {
-        Token tok = tokens->a[i];
+        Token tok = token_store_get(tokens, i);
         printf("Token %zu: type = ", i);
         switch (tok.type) {
             case token_type_exit_kw:       printf("exit_kw"); break;
@@ -87,8 +84,9 @@ void print_tokens(TokenArray* tokens) {
             default:                       printf("unknown"); break;
         }
 
-        if (tok.value) {
-            printf(", value = '%s'\n", tok.value);
+        const char* value = token_value(tok);
+        if (value) {
+            printf(", value = '%s'\n", value);
         } else {
             printf(", value = NULL\n");
         }
@@ -104,15 +102,15 @@ void print_optional_prog(OptionalNodeProg* prog) {
     }
 
     NodeProg* p = &prog->value;
-    size_t n = kv_size(p->stmt);
+    size_t n = p->stmt.count;
 
     for (size_t i = 0; i < n; i++) {
-        NodeStmt* stmt = &kv_A(p->stmt, i);
+        NodeStmt* stmt = ast_stmt(p, ast_list_at(p, p->stmt, i));
 
         switch (stmt->kind) {
             case NODE_STMT_EXIT:
                 printf("Statement %zu: EXIT\n", i);
-                switch (stmt->as.exit_.expr.kind) {
+                switch (ast_expr(p, stmt->as.exit_.expr)->kind) {
                     case NODE_EXPR_INT_LIT:
                         printf("  Expr: INT_LIT\n");
                         break;
@@ -130,7 +128,7 @@ void print_optional_prog(OptionalNodeProg* prog) {
 
             case NODE_STMT_CHAR:
                 printf("Statement %zu: CHAR\n", i);
-                switch (stmt->as.char_.expr.kind) {
+                switch (ast_expr(p, stmt->as.char_.expr)->kind) {
                     case NODE_EXPR_INT_LIT:
                         printf("  Expr: INT_LIT\n");
                         break;
@@ -150,7 +148,7 @@ void print_optional_prog(OptionalNodeProg* prog) {
                 break;
             case NODE_STMT_IF:
                 printf("Statement %zu: IF\n",i);
-                switch (stmt->as.if_.cond.kind) {
+                switch (ast_expr(p, stmt->as.if_.cond)->kind) {
                     case NODE_EXPR_INT_LIT:
                         printf("    Expr: INT_LIT\n");
                         break;
@@ -167,7 +165,7 @@ void print_optional_prog(OptionalNodeProg* prog) {
                 break;
             case NODE_STMT_WHILE:
                 printf("Statement %zu: WHILE\n",i);
-                switch (stmt->as.while_.cond.kind) {
+                switch (ast_expr(p, stmt->as.while_.cond)->kind) {
                     case NODE_EXPR_INT_LIT:
                         printf("    Expr: INT_LIT\n");
                         break;
@@ -178,9 +176,10 @@ void print_optional_prog(OptionalNodeProg* prog) {
                         printf("    Expr: BIN\n");
                         break;
                 }
+                break;
             case NODE_STMT_FOR:
                 printf("Statement %zu: FOR\n",i);
-                switch (stmt->as.for_.cond2.kind) {
+                switch (ast_expr(p, stmt->as.for_.cond2)->kind) {
                     case NODE_EXPR_INT_LIT:
                         printf("    Expr: INT_LIT\n");
                         break;
@@ -191,27 +190,29 @@ void print_optional_prog(OptionalNodeProg* prog) {
                         printf("    Expr: BIN\n");
                         break;
                 }
-                switch (stmt->as.for_.cond3->kind) {
+                switch (ast_stmt(p, stmt->as.for_.cond3)->kind) {
                     case NODE_STMT_VCHANGE:
                         printf("    Stmt: VCHANGE\n");
                         break;
                 }
+                break;
             case NODE_STMT_FUNC:
                 printf("Statement %zu: FUNC\n",i);
-                printf("    Name:%s\n",stmt->as.func.name.value);
-                printf("    return type:%d\n",stmt->as.func.ExpectedReturnType.type);
+                printf("    Name:%s\n",token_value(ast_tok(p, stmt->as.func.name)));
+                printf("    return type:%d\n",ast_tok(p, stmt->as.func.ExpectedReturnType).type);
                 break;
             case NODE_STMT_FUNC_USE:
                 printf("Statemnet %zu: FUNC_USE\n",i);
-                printf("    Name:%s\n", stmt->as.func_call.name.value);
+                printf("    Name:%s\n", token_value(ast_tok(p, stmt->as.func_call.name)));
                 break;
             case NODE_STMT_RETURN:
                 printf("Statement %zu: RETURN\n", i);
-                printf("    Expected type: %d\n", stmt->as.return_.res.kind);
+                printf("    Expected type: %d\n", stmt->as.return_.res == AST_NONE
+                                               ? NODE_EXPR_EMPTY : ast_expr(p, stmt->as.return_.res)->kind);
                 break;
             case NODE_STMT_INT:
                 printf("Statement %zu: INT\n",i);
-                printf("    ident: %s\n", stmt->as.int_.ident.value);
+                printf("    ident: %s\n", token_value(ast_tok(p, stmt->as.int_.ident)));
                 break;
             }
     }
@@ -219,27 +220,62 @@ void print_optional_prog(OptionalNodeProg* prog) {
 
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
+    // --lazy: only parse function bodies that reachable code calls, errors
+    // in the others are not reported
+    bool lazy = argc == 3 && strcmp(argv[1], "--lazy") == 0;
+    if (argc != 2 + lazy) {
         fprintf(stderr, "No file provided\n");
-        fprintf(stderr, "Usage: %s <input.v>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--lazy] <input.v>\n", argv[0]);
         return EXIT_FAILURE;
     }
+    const char* path = argv[argc - 1];
 
     // file reading
     StringView content;
-    if (load_file(argv[1], &content) != EXIT_SUCCESS) {
+    if (load_file(path, &content) != EXIT_SUCCESS) {
         return EXIT_FAILURE;
     }
 
-    Token_data* t_data = tokenizer_create(content.data);
-    TokenArray t_result = tokenize(t_data);
+#ifdef DUMP_TOKENS
+    // debug only: lex the whole file up front so it can be printed
+    Token_data* dump_data = tokenizer_create(content);
+    TokenStore t_result = tokenize(dump_data);
     printf("TOKENIZER RESULT:\n");
     print_tokens(&t_result);
-
-    Parser_data* p_data = init_parser(t_result);
-    OptionalNodeProg p_result = parse_prog(p_data);
-
-    free(t_result.a);
+    token_store_free(&t_result);
+    free(dump_data);
+#endif
+
+    // a source that was compiled before goes straight to codegen
+    SourceLines lines; // only filled in if something gets reported
+    source_lines_init(&lines, content.data, content.size);
+    uint64_t cache_key = ast_cache_key(content);
+    uint32_t cache_flags = lazy ? AST_CACHE_LAZY : 0; // how a cached program may have been parsed
+    OptionalNodeProg p_result = {0};
+    if (ast_cache_load(cache_key, content.size, cache_flags, &p_result.value)) {
+        p_result.has_value = 1;
+    } else {
+        // big sources are lexed up front on every core, everything else streams:
+        // the parser pulls tokens from the lexer and the token list is never fully resident.
+        // with the whole token list at hand top-level functions are parsed on every core too
+        TokenStore t_result;
+        token_store_init(&t_result);
+        uint32_t parsed_flags = 0; // the parallel parse builds every body
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cores > 1 && content.size >= 2 * PARALLEL_LEX_MIN_CHUNK) {
+            t_result = tokenize_parallel(content, (int)cores);
+            p_result = parse_prog_parallel(&t_result, &lines, (int)cores);
+        } else {
+            Token_data* t_data = tokenizer_create(content);
+            Parser_data* parser = init_parser_stream(t_data, &lines);
+            if (!parser) { fprintf(stderr, "Out of memory\n"); return EXIT_FAILURE; }
+            parser->m_lazy = lazy;
+            p_result = parse_prog(parser);
+            parsed_flags = cache_flags;
+        }
+        token_store_free(&t_result);
+        if (p_result.has_value) ast_cache_store(cache_key, content.size, parsed_flags, &p_result.value);
+    }
 
 
     if (!p_result.has_value) {
@@ -283,6 +319,8 @@ int main(int argc, char *argv[]) {
 
 
 
+    ast_free(&p_result.value);
+    source_lines_free(&lines);
     munmap(content.data, content.size);
     return EXIT_SUCCESS;
 }
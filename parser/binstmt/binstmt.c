@@ -1,5 +1,5 @@
 // parser/binstmt/binstmt.c
-#include "../parser.h"
+#include "binstmt.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -56,226 +56,171 @@ static BinExprKind token_to_bin_kind(TokenType t) {
 }
 
 // ---------------------
-// Helpers that operate on a Parser_data "slice"
+// Constructors for NodeExpr/BinExpr
 // ---------------------
-static OptionalToken slice_peek(Parser_data* p, int offset) {
-    OptionalToken res;
-    int idx = p->m_index + offset;
-    if (idx < 0 || idx >= kv_size(p->m_tokens)) {
-        res.has_value = 0;
-        Token empty = { .type = token_empty, .value = NULL };
-        res.value = empty;
-    } else {
-        res.has_value = 1;
-        res.value = kv_A(p->m_tokens, idx);
-    }
-    return res;
-}
-
-static Token slice_consume(Parser_data* p) {
-    Token t = kv_A(p->m_tokens, p->m_index);
-    p->m_index += 1;
-    return t;
+// leaves and calls are complete as soon as they are read
+static ExprId push_operand(NodeProg* ast, NodeExpr n) {
+    ExprId id = ast_push_expr(ast, n);
+    ast_push_rpn(ast, RPN_OPERAND, 0, id);
+    return id;
 }
 
-// ---------------------
-// Constructors for NodeExpr/BinExpr
-// ---------------------
-static NodeExpr make_int(Token tok) {
+static ExprId make_int(Parser_data* p, Token tok) {
     NodeExpr n;
     n.kind = NODE_EXPR_INT_LIT;
-    n.as.int_lit.int_lit = tok;
-    return n;
+    n.as.int_lit.int_lit = ast_push_tok(p->m_ast, tok);
+    return push_operand(p->m_ast, n);
 }
 
-static NodeExpr make_ident(Token tok) {
+static ExprId make_ident(Parser_data* p, Token tok) {
     NodeExpr n;
     n.kind = NODE_EXPR_IDENT;
-    n.as.ident.ident = tok;
-    return n;
+    n.as.ident.ident = ast_push_tok(p->m_ast, tok);
+    return push_operand(p->m_ast, n);
 }
 
-static BindExprRec nodeexpr_value_to_bindrec(const NodeExpr *v) {
-    BindExprRec rec;
-    if (v->kind == NODE_EXPR_BIN && v->as.bin != NULL) {
-        rec.type = BIN_EXPR;
-        rec.as.bin_expr = v->as.bin;
-    } else {
-        NodeExpr *heap_n = (NodeExpr*)malloc(sizeof(NodeExpr));
-        if (!heap_n) { fprintf(stderr,"Out of memory\n"); exit(1); }
-        *heap_n = *v;
-        rec.type = NODE_EXPR;
-        rec.as.node_expr = heap_n;
-    }
-    return rec;
+static ExprId make_char(Parser_data* p, Token tok) {
+    NodeExpr n;
+    n.kind = NODE_EXPR_CHAR;
+    n.as.char_.char_ = ast_push_tok(p->m_ast, tok);
+    return push_operand(p->m_ast, n);
 }
 
-static NodeExpr make_bin_from_nodes(BinExprKind kind, NodeExpr left_val, NodeExpr right_val) {
-    BinExpr* b = (BinExpr*)malloc(sizeof(BinExpr));
-    if (!b) { fprintf(stderr,"Out of memory\n"); exit(1); }
-    b->kind = kind;
-
-    // initialize union members/children to safe NULLs
-    b->as.add.lhs = (BindExprRec){ .type = NODE_EXPR, .as.node_expr = NULL };
-    b->as.add.rhs = (BindExprRec){ .type = NODE_EXPR, .as.node_expr = NULL };
-    b->as.minus.lhs = (BindExprRec){ .type = NODE_EXPR, .as.node_expr = NULL };
-    b->as.minus.rhs = (BindExprRec){ .type = NODE_EXPR, .as.node_expr = NULL };
-    b->as.multi.lhs = (BindExprRec){ .type = NODE_EXPR, .as.node_expr = NULL };
-    b->as.multi.rhs = (BindExprRec){ .type = NODE_EXPR, .as.node_expr = NULL };
-    b->as.divide.lhs = (BindExprRec){ .type = NODE_EXPR, .as.node_expr = NULL };
-    b->as.divide.rhs = (BindExprRec){ .type = NODE_EXPR, .as.node_expr = NULL };
-    b->as.binop.lhs = (BindExprRec){ .type = NODE_EXPR, .as.node_expr = NULL };
-    b->as.binop.rhs = (BindExprRec){ .type = NODE_EXPR, .as.node_expr = NULL };
-
-    BindExprRec left_rec  = nodeexpr_value_to_bindrec(&left_val);
-    BindExprRec right_rec = nodeexpr_value_to_bindrec(&right_val);
-
-    switch (kind) {
-        case BIN_EXPR_ADD:    b->as.add.lhs = left_rec;    b->as.add.rhs = right_rec; break;
-        case BIN_EXPR_MINUS:  b->as.minus.lhs = left_rec;  b->as.minus.rhs = right_rec; break;
-        case BIN_EXPR_MULTI:  b->as.multi.lhs = left_rec;  b->as.multi.rhs = right_rec; break;
-        case BIN_EXPR_DIVIDE: b->as.divide.lhs = left_rec; b->as.divide.rhs = right_rec; break;
-        case BIN_EXPR_EQ: case BIN_EXPR_NEQ:
-        case BIN_EXPR_LT: case BIN_EXPR_LTE:
-        case BIN_EXPR_MR: case BIN_EXPR_MRE:
-        case BIN_EXPR_AND: case BIN_EXPR_OR:
-            b->as.binop.lhs = left_rec;
-            b->as.binop.rhs = right_rec;
-            break;
-        default:
-            fprintf(stderr,"make_bin_from_nodes: unsupported BinExprKind %d\n", kind);
-            exit(1);
-    }
-
+// both operands are already in the table (and in the postfix code)
+static ExprId make_bin_from_nodes(NodeProg* ast, BinExprKind kind, ExprId left, ExprId right) {
     NodeExpr out;
     out.kind = NODE_EXPR_BIN;
-    out.as.bin = b;
-    return out;
+    out.as.bin.kind = kind;
+    out.as.bin.lhs = left;
+    out.as.bin.rhs = right;
+    ExprId id = ast_push_expr(ast, out);
+    ast_push_rpn(ast, RPN_OPERATOR, kind, id);
+    return id;
 }
 
 // ---------------------
-// Pratt / precedence-climbing parser on the given Parser_data
+// Operator precedence parser, runs straight on the parser cursor.
+// pending operators and operands are kept on heap stacks instead of the C
+// stack, so neither long operator chains nor deep parentheses recurse.
+// an expression ends at the first token that can not continue it, which is
+// left for the caller (';', ')', '{', ',' ...)
 // ---------------------
-static NodeExpr parse_expr_prec_on_slice(Parser_data* p, int min_prec); // forward
-
-static NodeExpr parse_primary_on_slice(Parser_data* p) {
-    OptionalToken t = slice_peek(p, 0);
-    if (!t.has_value) {
-        fprintf(stderr,"parse_primary_on_slice: unexpected end\n");
-        exit(1);
-    }
-
-    if (t.value.type == token_type_int_lit) {
-        Token tk = slice_consume(p);
-        return make_int(tk);
-    }
-    if (t.value.type == token_type_ident) {
-        Token tk = slice_consume(p);
-        return make_ident(tk);
-    }
-    if (t.value.type == token_type_open_paren) {
-        slice_consume(p); // consume '('
-        NodeExpr inside = parse_expr_prec_on_slice(p, 0);
-        OptionalToken close = slice_peek(p, 0);
-        if (!close.has_value || close.value.type != token_type_close_paren) {
-            fprintf(stderr,"parse_primary_on_slice: expected ')'\n");
-            exit(1);
-        }
-        slice_consume(p); // consume ')'
-        return inside;
-    }
 
-    fprintf(stderr,"parse_primary_on_slice: unexpected token %d\n", t.value.type);
-    exit(1);
-}
-
-static NodeExpr parse_expr_prec_on_slice(Parser_data* p, int min_prec) {
-    NodeExpr left = parse_primary_on_slice(p);
-
-    while (1) {
-        OptionalToken op = slice_peek(p, 0);
-        if (!op.has_value) break;
-        int prec = op_precedence(op.value.type);
-        if (prec < min_prec) break;
-
-        Assoc assoc = op_assoc(op.value.type);
-        int next_min = (assoc == ASSOC_LEFT) ? prec + 1 : prec;
-
-        // consume operator
-        Token op_tok = slice_consume(p);
+// operator waiting for its right operand, prec < 0 marks an open '('
+typedef struct PendingOp {
+    BinExprKind kind;
+    int prec;
+} PendingOp;
 
-        // parse RHS
-        NodeExpr right = parse_expr_prec_on_slice(p, next_min);
+typedef kvec_t(PendingOp) PendingOps;
+typedef kvec_t(ExprId) Operands;
 
-        // map token -> BinExprKind and build node
-        BinExprKind kind = token_to_bin_kind(op_tok.type);
-        left = make_bin_from_nodes(kind, left, right);
-    }
-
-    return left;
+static void reduce_top(NodeProg* ast, PendingOps* ops, Operands* vals) {
+    PendingOp op = kv_pop(*ops);
+    ExprId right = kv_pop(*vals);
+    ExprId left = kv_pop(*vals);
+    kv_push(ExprId, *vals, make_bin_from_nodes(ast, op.kind, left, right));
 }
 
-// ---------------------
-// Public: parse a contiguous expression starting at p->m_index until the first ')' or ';'.
-// It consumes expression tokens by advancing p->m_index TO the terminator (but not the terminator).
-// ---------------------
-OptionalNodeExpr parse_expr_to_terminator(Parser_data* p) {
-    OptionalNodeExpr res = {0};
-
-    // scan for next ')' or ';'
-    int base = p->m_index;
-    int found_idx = -1;
-    int n = kv_size(p->m_tokens);
-    for (int i = base; i < n; ++i) {
-        Token tk = kv_A(p->m_tokens, i);
-        if (tk.type == token_type_close_paren || tk.type == token_type_semi) {
-            found_idx = i;
-            break;
+// name(arg, arg, ...), every argument is a single token
+static ExprId parse_call(Parser_data* p) {
+    NodeExprFunc call;
+    call.name = ast_push_tok(p->m_ast, parser_consume(p));
+    parser_consume(p); // (
+    size_t mark = list_begin(p);
+    while (parser_peek_kind(p, 0) != token_type_close_paren) {
+        if (parser_peek_kind(p, 0) == token_empty) break;
+        list_add(p, ast_push_tok(p->m_ast, parser_consume(p)));
+        if (parser_peek_kind(p, 0) == token_type_comma) {
+            parser_consume(p);
+            continue;
         }
+        break;
     }
-
-    if (found_idx == -1) {
-        // no terminator: fail
-        res.has_value = 0;
-        return res;
+    call.args = list_end(p, mark);
+    if (parser_peek_kind(p, 0) != token_type_close_paren) {
+        parser_error(p, "Expected ')'");
     }
+    parser_consume(p); // )
 
-    int ptr_max = found_idx - base - 1; // last token index of expression relative to base
-    if (ptr_max < 0) {
-        // empty expression
-        res.has_value = 0;
-        return res;
-    }
+    NodeExpr n;
+    n.kind = NODE_EXPR_FUNC;
+    n.as.func = call;
+    return push_operand(p->m_ast, n);
+}
 
-    // build temporary slice [base .. base + ptr_max]
-    TokenArray slice;
-    kv_init(slice);
-    for (int i = 0; i <= ptr_max; ++i) {
-        kv_push(Token, slice, kv_A(p->m_tokens, base + i));
+// leaf or call
+static ExprId parse_operand(Parser_data* p) {
+    TokenType t = parser_peek_kind(p, 0);
+    switch (t) {
+        case token_type_int_lit:
+            return make_int(p, parser_consume(p));
+        case token_type_char_v:
+            return make_char(p, parser_consume(p));
+        case token_type_ident:
+            if (parser_peek_kind(p, 1) == token_type_open_paren) return parse_call(p);
+            return make_ident(p, parser_consume(p));
+        case token_empty:
+            parser_error(p, "Unexpected end of expression");
+        default:
+            parser_error(p, "Unexpected token in expression (token type %d)", t);
     }
+}
 
-    Parser_data subp;
-    subp.m_index = 0;
-    subp.m_tokens = slice;
+ExprId parse_expr_prec(Parser_data* p, int min_prec) {
+    PendingOps ops;
+    Operands vals;
+    kv_init(ops);
+    kv_init(vals);
+    int open_parens = 0;
 
-    NodeExpr parsed = parse_expr_prec_on_slice(&subp, 0);
+    while (1) {
+        // operand expected
+        while (parser_peek_kind(p, 0) == token_type_open_paren) {
+            parser_consume(p); // (
+            PendingOp paren = { BIN_EXPR_ADD, -1 };
+            kv_push(PendingOp, ops, paren);
+            open_parens++;
+        }
+        kv_push(ExprId, vals, parse_operand(p));
+
+        // operator or ')' expected
+        TokenType op = parser_peek_kind(p, 0);
+        while (op == token_type_close_paren && open_parens > 0) {
+            while (kv_A(ops, kv_size(ops) - 1).prec >= 0) reduce_top(p->m_ast, &ops, &vals);
+            ops.n--; // the '('
+            open_parens--;
+            parser_consume(p); // )
+            op = parser_peek_kind(p, 0);
+        }
 
-    // advance parent parser index to the terminator (leave terminator for caller)
-    p->m_index = base + ptr_max + 1;
+        int prec = op_precedence(op);
+        if (prec < 0 && open_parens > 0) {
+            parser_error(p, "Expected ')'");
+        }
+        if (prec < 0 || (open_parens == 0 && prec < min_prec)) break;
+
+        // whatever binds at least as tight on the left is a complete operand now
+        Assoc assoc = op_assoc(op);
+        while (kv_size(ops) > 0) {
+            int top = kv_A(ops, kv_size(ops) - 1).prec;
+            if (top < 0 || top < prec || (top == prec && assoc == ASSOC_RIGHT)) break;
+            reduce_top(p->m_ast, &ops, &vals);
+        }
 
-    // convert to return type: if bin -> return BIN_EXPR, else NODE_EXPR (heap-allocate leaf)
-    if (parsed.kind == NODE_EXPR_BIN && parsed.as.bin != NULL) {
-        res.has_value = 1;
-        res.value = parsed;
-    } else {
-        // copy leaf to heap to match NodeExpr usage elsewhere (caller expects NodeExpr by value)
-        NodeExpr heap_n;
-        heap_n.kind = parsed.kind;
-        heap_n.as = parsed.as;
-        res.has_value = 1;
-        res.value = heap_n;
+        parser_consume(p); // operator
+        BinExprKind kind = token_to_bin_kind(op);
+        if (kind == BIN_EXPR_AND || kind == BIN_EXPR_OR) {
+            // short-circuit point, the left side is done and the right one not started
+            ast_push_rpn(p->m_ast, RPN_BRANCH, kind, AST_NONE);
+        }
+        PendingOp pending = { kind, prec };
+        kv_push(PendingOp, ops, pending);
     }
 
-    // Note: slice tokens are copies of tokenizer tokens; tokenizer-owned memory remains valid.
-    return res;
+    while (kv_size(ops) > 0) reduce_top(p->m_ast, &ops, &vals);
+    ExprId result = kv_A(vals, 0);
+    kv_destroy(ops);
+    kv_destroy(vals);
+    return result;
 }
@@ -1,4 +1,6 @@
 #pragma once
 #include "../parser.h"
 
-struct BindExprRec parse_bin_stmt_rec(Parser_data* p, BinExpr* top, int ptr,const int ptr_max);
+// expression whose operators all bind at least as tight as min_prec (0 takes everything).
+// nodes are pushed as they complete, so the subtree of the result is in postfix order
+ExprId parse_expr_prec(Parser_data* p, int min_prec);
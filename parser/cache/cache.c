@@ -0,0 +1,413 @@
+#include "cache.h"
+#include "../../libs/khashl.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ---- File layout ----
+// header, then the six tables each 8 byte aligned, then the string table:
+// a u32 count followed by (u32 len, bytes) per symbol. a token's sym holds
+// its 1 based index in the string table, 0 for SYMBOL_NONE.
+
+static const char AST_CACHE_MAGIC[8] = { 'V', 'A', 'S', 'T', 'C', 'A', 'C', 1 };
+
+// bump when the meaning of a node, token or table changes. the element sizes
+// in the header catch changes of struct layout, and the number of kinds of
+// every enum stored goes into the version word, so adding or removing a kind
+// needs no bump
+#define AST_CACHE_FORMAT 2
+
+static uint64_t cache_version(void) {
+    return (uint64_t)AST_CACHE_FORMAT
+         | (uint64_t)(NODE_STMT_RETURN + 1) << 8
+         | (uint64_t)(NODE_EXPR_EMPTY + 1) << 16
+         | (uint64_t)(BIN_EXPR_OR + 1) << 24
+         | (uint64_t)(RPN_OPERATOR + 1) << 32
+         | (uint64_t)(token_empty + 1) << 40;
+}
+
+enum {
+    CACHE_STMTS,
+    CACHE_EXPRS,
+    CACHE_TOKS,
+    CACHE_LISTS,
+    CACHE_RPN,
+    CACHE_CODES,
+    CACHE_TABLES,
+};
+
+typedef struct CacheTable {
+    uint64_t offset;
+    uint64_t count;
+    uint64_t elem; // sizeof one entry in the build that wrote it
+} CacheTable;
+
+typedef struct CacheHeader {
+    char magic[8];
+    uint64_t version;   // cache_version() of the build that wrote it
+    uint32_t flags;     // AST_CACHE_* the program was parsed with
+    uint32_t pad;
+    uint64_t key;
+    uint64_t src_len;
+    AstList stmt;
+    CacheTable tables[CACHE_TABLES];
+    uint64_t strings;   // offset of the string table
+    uint64_t file_size;
+} CacheHeader;
+
+static const uint64_t table_elem[CACHE_TABLES] = {
+    sizeof(NodeStmt), sizeof(NodeExpr), sizeof(Token),
+    sizeof(uint32_t), sizeof(RpnOp), sizeof(ExprCode),
+};
+
+// NULL when the cache is turned off
+static const char* cache_dir(void) {
+    if (getenv("VNOCACHE")) return NULL;
+    const char* dir = getenv("VCACHE_DIR");
+    return dir && *dir ? dir : AST_CACHE_DIR;
+}
+
+// false if the path does not fit
+static bool cache_path(char* buf, size_t n, const char* dir, uint64_t key, const char* suffix) {
+    int len = snprintf(buf, n, "%s/%016llx%s", dir, (unsigned long long)key, suffix);
+    return len >= 0 && (size_t)len < n;
+}
+
+// ---- Source key ----
+// eight bytes per step, the length goes in as well
+uint64_t ast_cache_key(StringView src) {
+    const unsigned char* s = (const unsigned char*)src.data;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ (uint64_t)src.size;
+    size_t i = 0;
+    for (; i + 8 <= src.size; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    for (; i < src.size; i++) h = (h ^ s[i]) * 0x100000001b3ull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// ---- Store ----
+KHASHL_MAP_INIT(KH_LOCAL, sym_index_t, sym_index, Symbol, uint32_t, kh_hash_uint32, kh_eq_generic)
+
+typedef struct CacheWriter {
+    FILE* f;
+    uint64_t pos;
+    int failed;
+} CacheWriter;
+
+static void cache_write(CacheWriter* w, const void* data, size_t size) {
+    if (size == 0 || w->failed) return;
+    if (fwrite(data, 1, size, w->f) != size) w->failed = 1;
+    w->pos += size;
+}
+
+static void cache_align(CacheWriter* w) {
+    static const char zeros[8] = { 0 };
+    cache_write(w, zeros, (8 - w->pos % 8) % 8);
+}
+
+static void cache_table(CacheWriter* w, CacheHeader* h, int t, const void* data, size_t count) {
+    cache_align(w);
+    h->tables[t].offset = w->pos;
+    h->tables[t].count = count;
+    h->tables[t].elem = table_elem[t];
+    cache_write(w, data, count * table_elem[t]);
+}
+
+void ast_cache_store(uint64_t key, size_t src_len, uint32_t flags, const NodeProg* prog) {
+    const char* dir = cache_dir();
+    if (!dir) return;
+    char tmp[PATH_MAX], path[PATH_MAX], suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+    if (!cache_path(path, sizeof(path), dir, key, ".ast")
+        || !cache_path(tmp, sizeof(tmp), dir, key, suffix)) return;
+    mkdir(dir, 0755); // usually there already
+
+    CacheWriter w = { fopen(tmp, "wb"), 0, 0 };
+    if (!w.f) return;
+
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, AST_CACHE_MAGIC, sizeof(h.magic));
+    h.version = cache_version();
+    h.flags = flags;
+    h.key = key;
+    h.src_len = src_len;
+    h.stmt = prog->stmt;
+    cache_write(&w, &h, sizeof(h)); // filled in at the end
+
+    cache_table(&w, &h, CACHE_STMTS, prog->stmts.a, kv_size(prog->stmts));
+    cache_table(&w, &h, CACHE_EXPRS, prog->exprs.a, kv_size(prog->exprs));
+
+    // tokens with their symbol swapped for a string table index
+    sym_index_t* index = sym_index_init();
+    kvec_t(Symbol) syms;
+    kv_init(syms);
+    cache_table(&w, &h, CACHE_TOKS, NULL, 0);
+    h.tables[CACHE_TOKS].count = kv_size(prog->toks);
+    for (size_t i = 0; i < kv_size(prog->toks); i++) {
+        Token src = kv_A(prog->toks, i);
+        Token tok;
+        memset(&tok, 0, sizeof(tok)); // no stray padding bytes in the file
+        tok.type = src.type;
+        tok.offset = src.offset;
+        tok.len = src.len;
+        tok.lit = src.lit;
+        tok.sym = 0;
+        if (src.sym != SYMBOL_NONE) {
+            int absent;
+            khint_t k = sym_index_put(index, src.sym, &absent);
+            if (absent) {
+                kv_push(Symbol, syms, src.sym);
+                kh_val(index, k) = (uint32_t)kv_size(syms);
+            }
+            tok.sym = kh_val(index, k);
+        }
+        cache_write(&w, &tok, sizeof(tok));
+    }
+
+    cache_table(&w, &h, CACHE_LISTS, prog->lists.a, kv_size(prog->lists));
+    cache_table(&w, &h, CACHE_RPN, prog->rpn.a, kv_size(prog->rpn));
+    cache_table(&w, &h, CACHE_CODES, prog->codes.a, kv_size(prog->codes));
+
+    cache_align(&w);
+    h.strings = w.pos;
+    uint32_t n_syms = (uint32_t)kv_size(syms);
+    cache_write(&w, &n_syms, sizeof(n_syms));
+    for (size_t i = 0; i < kv_size(syms); i++) {
+        uint32_t len = (uint32_t)intern_len(kv_A(syms, i));
+        cache_write(&w, &len, sizeof(len));
+        cache_write(&w, intern_str(kv_A(syms, i)), len);
+    }
+    h.file_size = w.pos;
+    sym_index_destroy(index);
+    kv_destroy(syms);
+
+    if (!w.failed && fseek(w.f, 0, SEEK_SET) == 0) {
+        if (fwrite(&h, 1, sizeof(h), w.f) != sizeof(h)) w.failed = 1;
+    } else {
+        w.failed = 1;
+    }
+    if (fclose(w.f) != 0) w.failed = 1;
+    // a reader either sees the old file or the complete new one
+    if (w.failed || rename(tmp, path) != 0) unlink(tmp);
+}
+
+// ---- Load ----
+static bool cache_header_ok(const CacheHeader* h, uint64_t key, size_t src_len, uint32_t flags, size_t file_size) {
+    if (memcmp(h->magic, AST_CACHE_MAGIC, sizeof(h->magic)) != 0) return false;
+    // a full parse serves a lazy one, not the other way round
+    if (h->version != cache_version() || (h->flags & ~flags) != 0) return false;
+    if (h->key != key || h->src_len != src_len || h->file_size != file_size) return false;
+    for (int t = 0; t < CACHE_TABLES; t++) {
+        const CacheTable* table = &h->tables[t];
+        if (table->elem != table_elem[t] || table->offset % 8 != 0) return false;
+        if (table->offset > file_size || table->count > (file_size - table->offset) / table->elem) return false;
+    }
+    return h->strings + sizeof(uint32_t) <= file_size;
+}
+
+// interns the string table and points every token at its symbol
+static bool cache_patch_symbols(char* map, const CacheHeader* h) {
+    const char* at = map + h->strings;
+    const char* end = map + h->file_size;
+    uint32_t n_syms;
+    memcpy(&n_syms, at, sizeof(n_syms));
+    at += sizeof(n_syms);
+
+    Symbol* syms = (Symbol*)malloc(sizeof(Symbol) * ((size_t)n_syms + 1));
+    if (!syms) return false;
+    syms[0] = SYMBOL_NONE;
+    for (uint32_t i = 1; i <= n_syms; i++) {
+        uint32_t len;
+        if ((size_t)(end - at) < sizeof(len)) { free(syms); return false; }
+        memcpy(&len, at, sizeof(len));
+        at += sizeof(len);
+        if ((size_t)(end - at) < len) { free(syms); return false; }
+        syms[i] = intern(at, len);
+        at += len;
+    }
+
+    Token* toks = (Token*)(map + h->tables[CACHE_TOKS].offset);
+    for (uint64_t i = 0; i < h->tables[CACHE_TOKS].count; i++) {
+        if (toks[i].sym > n_syms) { free(syms); return false; }
+        toks[i].sym = syms[toks[i].sym];
+    }
+    free(syms);
+    return true;
+}
+
+// ---- Index check ----
+// every id in the mapped tables has to point into its table. a file that
+// passed the header check can still be stale, corrupt or another source with
+// the same key, anything out of range is a miss instead of a bad read later
+typedef struct CacheCheck {
+    const NodeProg* prog;
+    bool ok;
+} CacheCheck;
+
+static void check_id(CacheCheck* c, uint32_t id, size_t count, bool optional) {
+    if (id == AST_NONE ? !optional : id >= count) c->ok = false;
+}
+
+#define CHECK_STMT(c, id, optional) check_id(c, id, kv_size((c)->prog->stmts), optional)
+#define CHECK_EXPR(c, id, optional) check_id(c, id, kv_size((c)->prog->exprs), optional)
+#define CHECK_TOK(c, id)            check_id(c, id, kv_size((c)->prog->toks), false)
+
+// table: the table the entries of the list point into
+static void check_list(CacheCheck* c, AstList list, size_t table) {
+    size_t lists = kv_size(c->prog->lists);
+    if (list.start > lists || list.count > lists - list.start) { c->ok = false; return; }
+    for (uint32_t i = 0; i < list.count; i++) {
+        check_id(c, kv_A(c->prog->lists, list.start + i), table, false);
+    }
+}
+
+static void check_stmt(CacheCheck* c, const NodeStmt* stmt) {
+    const NodeProg* prog = c->prog;
+    size_t stmts = kv_size(prog->stmts), toks = kv_size(prog->toks);
+    switch (stmt->kind) {
+        case NODE_STMT_EXIT:    CHECK_EXPR(c, stmt->as.exit_.expr, false); break;
+        case NODE_STMT_CHAR:    CHECK_TOK(c, stmt->as.char_.ident);   CHECK_EXPR(c, stmt->as.char_.expr, false); break;
+        case NODE_STMT_INT:     CHECK_TOK(c, stmt->as.int_.ident);    CHECK_EXPR(c, stmt->as.int_.expr, false); break;
+        case NODE_STMT_SHORT:   CHECK_TOK(c, stmt->as.short_.ident);  CHECK_EXPR(c, stmt->as.short_.expr, false); break;
+        case NODE_STMT_LONG:    CHECK_TOK(c, stmt->as.long_.ident);   CHECK_EXPR(c, stmt->as.long_.expr, false); break;
+        case NODE_STMT_VCHANGE: CHECK_TOK(c, stmt->as.vchange.ident); CHECK_EXPR(c, stmt->as.vchange.expr, false); break;
+        case NODE_STMT_IF:
+            CHECK_EXPR(c, stmt->as.if_.cond, false);
+            check_list(c, stmt->as.if_.body, stmts);
+            break;
+        case NODE_STMT_ELSE:
+            check_list(c, stmt->as.else_.body, stmts);
+            break;
+        case NODE_STMT_WHILE:
+            CHECK_EXPR(c, stmt->as.while_.cond, false);
+            check_list(c, stmt->as.while_.body, stmts);
+            break;
+        case NODE_STMT_FOR:
+            CHECK_STMT(c, stmt->as.for_.cond1, true);
+            CHECK_EXPR(c, stmt->as.for_.cond2, true);
+            CHECK_STMT(c, stmt->as.for_.cond3, true);
+            check_list(c, stmt->as.for_.body, stmts);
+            break;
+        case NODE_STMT_FUNC_USE:
+            CHECK_TOK(c, stmt->as.func_call.name);
+            check_list(c, stmt->as.func_call.args, toks);
+            break;
+        case NODE_STMT_FUNC:
+            CHECK_TOK(c, stmt->as.func.name);
+            CHECK_TOK(c, stmt->as.func.ExpectedReturnType);
+            check_list(c, stmt->as.func.body, stmts);
+            check_list(c, stmt->as.func.types, toks);
+            break;
+        case NODE_STMT_RETURN:
+            CHECK_EXPR(c, stmt->as.return_.res, true);
+            break;
+        default:
+            c->ok = false;
+            break;
+    }
+}
+
+static void check_expr(CacheCheck* c, const NodeExpr* expr) {
+    switch (expr->kind) {
+        case NODE_EXPR_INT_LIT: CHECK_TOK(c, expr->as.int_lit.int_lit); break;
+        case NODE_EXPR_IDENT:   CHECK_TOK(c, expr->as.ident.ident); break;
+        case NODE_EXPR_CHAR:    CHECK_TOK(c, expr->as.char_.char_); break;
+        case NODE_EXPR_FUNC:
+            CHECK_TOK(c, expr->as.func.name);
+            check_list(c, expr->as.func.args, kv_size(c->prog->toks));
+            break;
+        case NODE_EXPR_BIN:
+            if ((unsigned)expr->as.bin.kind > BIN_EXPR_OR) c->ok = false;
+            CHECK_EXPR(c, expr->as.bin.lhs, false);
+            CHECK_EXPR(c, expr->as.bin.rhs, false);
+            break;
+        case NODE_EXPR_EMPTY:
+            break;
+        default:
+            c->ok = false;
+            break;
+    }
+}
+
+static bool cache_indices_ok(const NodeProg* prog) {
+    CacheCheck c = { prog, true };
+    check_list(&c, prog->stmt, kv_size(prog->stmts));
+    for (size_t i = 0; c.ok && i < kv_size(prog->stmts); i++) check_stmt(&c, &kv_A(prog->stmts, i));
+    for (size_t i = 0; c.ok && i < kv_size(prog->exprs); i++) check_expr(&c, &kv_A(prog->exprs, i));
+    for (size_t i = 0; c.ok && i < kv_size(prog->toks); i++) {
+        if ((unsigned)kv_A(prog->toks, i).type > token_empty) c.ok = false;
+    }
+    for (size_t i = 0; c.ok && i < kv_size(prog->rpn); i++) {
+        const RpnOp* op = &kv_A(prog->rpn, i);
+        if (op->kind > RPN_OPERATOR || op->op > BIN_EXPR_OR) c.ok = false;
+        CHECK_EXPR(&c, op->expr, op->kind == RPN_BRANCH);
+    }
+    for (size_t i = 0; c.ok && i < kv_size(prog->codes); i++) {
+        const ExprCode* code = &kv_A(prog->codes, i);
+        size_t rpn = kv_size(prog->rpn);
+        CHECK_EXPR(&c, code->root, false);
+        if (code->ops.start > rpn || code->ops.count > rpn - code->ops.start) c.ok = false;
+    }
+    return c.ok;
+}
+
+#define CACHE_VIEW(vec, map, table)                         \
+    do {                                                    \
+        (vec).a = (void*)((map) + (table).offset);          \
+        (vec).n = (vec).m = (size_t)(table).count;          \
+    } while (0)
+
+bool ast_cache_load(uint64_t key, size_t src_len, uint32_t flags, NodeProg* out) {
+    const char* dir = cache_dir();
+    char path[PATH_MAX];
+    if (!dir || !cache_path(path, sizeof(path), dir, key, ".ast")) return false;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+    // private and writable: only the token pages are copied, when their symbols are patched
+    char* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const CacheHeader* h = (const CacheHeader*)map;
+    if (!cache_header_ok(h, key, src_len, flags, (size_t)st.st_size)
+        || !cache_patch_symbols(map, h)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    ast_init(out);
+    CACHE_VIEW(out->stmts, map, h->tables[CACHE_STMTS]);
+    CACHE_VIEW(out->exprs, map, h->tables[CACHE_EXPRS]);
+    CACHE_VIEW(out->toks, map, h->tables[CACHE_TOKS]);
+    CACHE_VIEW(out->lists, map, h->tables[CACHE_LISTS]);
+    CACHE_VIEW(out->rpn, map, h->tables[CACHE_RPN]);
+    CACHE_VIEW(out->codes, map, h->tables[CACHE_CODES]);
+    out->stmt = h->stmt;
+    if (!cache_indices_ok(out)) {
+        ast_init(out);
+        munmap(map, st.st_size);
+        return false;
+    }
+    out->map = map;
+    out->map_len = (size_t)st.st_size;
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../parser.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// On-disk copy of a parsed program, keyed by a hash of the source.
+// every table of NodeProg is written as is: nodes refer to each other by
+// index, so the file needs no fixups and the tables are used straight from
+// the mapping. symbols are the only process local part, tokens store an
+// index into the file's string table and are re-interned on load.
+
+// files go to <dir>/<key>.ast. the directory is $VCACHE_DIR, or
+// AST_CACHE_DIR relative to where the compiler runs. setting VNOCACHE turns
+// the cache off, nothing is read or written
+#define AST_CACHE_DIR ".vcache"
+
+// how the program was parsed. a file is only used by a compile that allows
+// everything it was parsed with
+#define AST_CACHE_LAZY 1u // bodies nothing calls may have been skipped
+
+uint64_t ast_cache_key(StringView src);
+
+// maps the program cached for this source into *out, false on a miss or a
+// file written by another build or with flags outside of flags. free it with ast_free()
+bool ast_cache_load(uint64_t key, size_t src_len, uint32_t flags, NodeProg* out);
+
+// flags: how prog was parsed. failing to write only costs the next compile its hit
+void ast_cache_store(uint64_t key, size_t src_len, uint32_t flags, const NodeProg* prog);
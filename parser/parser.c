@@ -3,37 +3,237 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include "./binstmt/binstmt.h"
 #include <stdbool.h>
-// forward declaration implemented in binstmt.c
-extern BindExprRec parse_bin_stmt_rec(Parser_data* p, BinExpr* top, int ptr, const int ptr_max);
+#include <stdatomic.h>
+#include <pthread.h>
+#include "../libs/khashl.h"
+#include <sys/mman.h>
+
+// ---- AST storage ----
+void ast_init(NodeProg* a) {
+    kv_init(a->stmts);
+    kv_init(a->exprs);
+    kv_init(a->toks);
+    kv_init(a->lists);
+    kv_init(a->rpn);
+    kv_init(a->codes);
+    a->stmt.start = 0;
+    a->stmt.count = 0;
+    a->map = NULL;
+    a->map_len = 0;
+}
+
+void ast_free(NodeProg* a) {
+    if (a->map) {
+        munmap(a->map, a->map_len);
+        ast_init(a);
+        return;
+    }
+    kv_destroy(a->stmts);
+    kv_destroy(a->exprs);
+    kv_destroy(a->toks);
+    kv_destroy(a->lists);
+    kv_destroy(a->rpn);
+    kv_destroy(a->codes);
+    ast_init(a);
+}
+
+StmtId ast_push_stmt(NodeProg* a, NodeStmt stmt) {
+    kv_push(NodeStmt, a->stmts, stmt);
+    return (StmtId)(kv_size(a->stmts) - 1);
+}
+
+ExprId ast_push_expr(NodeProg* a, NodeExpr expr) {
+    kv_push(NodeExpr, a->exprs, expr);
+    return (ExprId)(kv_size(a->exprs) - 1);
+}
+
+TokId ast_push_tok(NodeProg* a, Token tok) {
+    kv_push(Token, a->toks, tok);
+    return (TokId)(kv_size(a->toks) - 1);
+}
+
+void ast_push_rpn(NodeProg* a, RpnKind kind, BinExprKind op, ExprId expr) {
+    RpnOp r;
+    r.kind = (uint8_t)kind;
+    r.op = (uint8_t)op;
+    r.expr = expr;
+    kv_push(RpnOp, a->rpn, r);
+}
+
+AstList ast_expr_code(const NodeProg* a, ExprId root) {
+    // roots are recorded in the order they are parsed, which is id order
+    size_t lo = 0, hi = kv_size(a->codes);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (kv_A(a->codes, mid).root < root) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == kv_size(a->codes) || kv_A(a->codes, lo).root != root) {
+        fprintf(stderr, "ast_expr_code: expression %u has no code\n", root);
+        exit(1);
+    }
+    return kv_A(a->codes, lo).ops;
+}
+
+// ---- Child lists ----
+// a body is only known once its last statement is parsed, and nested bodies
+// finish first. ids are collected on the scratch stack and copied into
+// NodeProg.lists in one piece when the list ends, so every list is contiguous.
+size_t list_begin(Parser_data* p) {
+    return kv_size(p->m_scratch);
+}
+
+void list_add(Parser_data* p, uint32_t id) {
+    kv_push(uint32_t, p->m_scratch, id);
+}
+
+AstList list_end(Parser_data* p, size_t mark) {
+    NodeProg* a = p->m_ast;
+    AstList l;
+    l.start = (uint32_t)kv_size(a->lists);
+    l.count = (uint32_t)(kv_size(p->m_scratch) - mark);
+    for (size_t i = mark; i < kv_size(p->m_scratch); i++) {
+        kv_push(uint32_t, a->lists, kv_A(p->m_scratch, i));
+    }
+    p->m_scratch.n = mark;
+    return l;
+}
 
 // ---- Parser data initialization ----
-Parser_data* init_parser(TokenArray src) {
+Parser_data* init_parser(TokenStore src, SourceLines* lines) {
     Parser_data* p = (Parser_data*)malloc(sizeof(Parser_data));
     if (!p) return NULL;
     p->m_index = 0;
     p->m_tokens = src;
+    p->m_end = src.n;
+    p->m_lexer = NULL;
+    p->m_ring = NULL;
+    p->m_ring_cap = 0;
+    p->m_ring_head = 0;
+    p->m_ring_count = 0;
+    p->m_lines = lines;
+    p->m_ast = NULL;
+    p->m_lazy = false;
+    kv_init(p->m_scratch);
     return p;
 }
 
+// parser that pulls tokens from the lexer as it goes, only the lookahead is kept around
+Parser_data* init_parser_stream(Token_data* lexer, SourceLines* lines) {
+    Parser_data* p = (Parser_data*)malloc(sizeof(Parser_data));
+    if (!p) return NULL;
+    p->m_index = 0;
+    token_store_init(&p->m_tokens);
+    p->m_end = 0;
+    p->m_lexer = lexer;
+    p->m_ring = (Token*)malloc(sizeof(Token) * PARSER_LOOKAHEAD);
+    if (!p->m_ring) { free(p); return NULL; }
+    p->m_ring_cap = PARSER_LOOKAHEAD;
+    p->m_ring_head = 0;
+    p->m_ring_count = 0;
+    p->m_lines = lines;
+    p->m_ast = NULL;
+    p->m_lazy = false;
+    kv_init(p->m_scratch);
+    return p;
+}
+
+// ---- Streaming ring buffer ----
+// makes sure the token at offset is buffered, returns 0 if the source ends first
+static int ring_fill(Parser_data* p, int offset) {
+    while (p->m_ring_count <= (size_t)offset) {
+        if (p->m_ring_count == p->m_ring_cap) {
+            // unroll into a buffer twice the size so the live tokens stay in order
+            size_t cap = p->m_ring_cap * 2;
+            Token* ring = (Token*)malloc(sizeof(Token) * cap);
+            if (!ring) { fprintf(stderr,"Out of memory\n"); exit(1); }
+            for (size_t i = 0; i < p->m_ring_count; i++) {
+                ring[i] = p->m_ring[(p->m_ring_head + i) & (p->m_ring_cap - 1)];
+            }
+            free(p->m_ring);
+            p->m_ring = ring;
+            p->m_ring_cap = cap;
+            p->m_ring_head = 0;
+        }
+        Token tok;
+        if (!tokenizer_next(p->m_lexer, &tok)) return 0;
+        p->m_ring[(p->m_ring_head + p->m_ring_count) & (p->m_ring_cap - 1)] = tok;
+        p->m_ring_count++;
+    }
+    return 1;
+}
+
+static inline Token* ring_at(Parser_data* p, int offset) {
+    return &p->m_ring[(p->m_ring_head + offset) & (p->m_ring_cap - 1)];
+}
+
 
 // ---- Peek next token ----
 // offset is relative to current p->m_index
 OptionalToken parser_peek(Parser_data* p, int offset) {
     OptionalToken result;
     int idx = p->m_index + offset;
-    if (idx < 0 || idx >= kv_size(p->m_tokens)) {
+    if (p->m_lexer) {
+        if (offset >= 0 && ring_fill(p, offset)) {
+            result.has_value = 1;
+            result.value = *ring_at(p, offset);
+            return result;
+        }
+        idx = -1;
+    }
+    if (idx < 0 || (size_t)idx >= p->m_end) {
         result.has_value = 0;
-        Token empty = { .type = token_empty, .value = NULL };
+        Token empty = { .type = token_empty };
         result.value = empty;
     } else {
         result.has_value = 1;
-        result.value = kv_A(p->m_tokens, idx);
+        result.value = token_store_get(&p->m_tokens, idx);
     }
     return result;
 }
 
+// ---- Peek only the kind of a token ----
+// token_empty past the end, reads one byte of the token store
+TokenType parser_peek_kind(Parser_data* p, int offset) {
+    if (p->m_lexer) {
+        if (offset < 0 || !ring_fill(p, offset)) return token_empty;
+        return ring_at(p, offset)->type;
+    }
+    int idx = p->m_index + offset;
+    if (idx < 0 || (size_t)idx >= p->m_end) return token_empty;
+    return token_store_kind(&p->m_tokens, idx);
+}
+
+// ---- Diagnostics ----
+// parser threads may fail at the same time, only the first one reports
+static pthread_mutex_t g_error_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// points at the current token, or the end of the source (or of a sub parser's
+// range) once it is used up
+void parser_error(Parser_data* p, const char* fmt, ...) {
+    pthread_mutex_lock(&g_error_lock); // held until exit
+    if (p->m_lines) {
+        OptionalToken cur = parser_peek(p, 0);
+        uint32_t offset = cur.has_value ? cur.value.offset : (uint32_t)p->m_lines->len;
+        if (!cur.has_value && !p->m_lexer && p->m_end < p->m_tokens.n) {
+            offset = p->m_tokens.offset[p->m_end];
+        }
+        SourceLoc loc = source_loc(p->m_lines, offset);
+        fprintf(stderr, "%u:%u: error: ", loc.line, loc.col);
+    } else {
+        fprintf(stderr, "error: ");
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
 bool is_type(TokenType type) {
     return type == token_type_char_t ||
            type == token_type_int ||
@@ -46,383 +246,82 @@ bool is_type(TokenType type) {
 
 // ---- Consume token ----
 Token parser_consume(Parser_data* p) {
-    return kv_A(p->m_tokens, p->m_index++);
+    if (p->m_lexer) {
+        if (!ring_fill(p, 0)) { fprintf(stderr,"Unexpected end of input\n"); exit(1); }
+        Token tok = *ring_at(p, 0);
+        p->m_ring_head = (p->m_ring_head + 1) & (p->m_ring_cap - 1);
+        p->m_ring_count--;
+        p->m_index++;
+        return tok;
+    }
+    return token_store_get(&p->m_tokens, p->m_index++);
 }
 
 // ---- Print binary expression (debug helper) ----
-void print_bin_expr(BinExpr* node, int depth) {
-    if (!node) return;
-
-    for (int i = 0; i < depth; i++) printf("-");
-
-        switch (node->kind) {
-        case BIN_EXPR_ADD:
-            printf("+\n");
-            if (node->as.add.lhs.type == BIN_EXPR) print_bin_expr(node->as.add.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.add.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.add.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.add.rhs.type == BIN_EXPR) print_bin_expr(node->as.add.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.add.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.add.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        case BIN_EXPR_MINUS:
-            printf("-\n");
-            if (node->as.minus.lhs.type == BIN_EXPR) print_bin_expr(node->as.minus.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.minus.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.minus.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.minus.rhs.type == BIN_EXPR) print_bin_expr(node->as.minus.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.minus.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.minus.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        case BIN_EXPR_MULTI:
-            printf("*\n");
-            if (node->as.multi.lhs.type == BIN_EXPR) print_bin_expr(node->as.multi.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.multi.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.multi.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.multi.rhs.type == BIN_EXPR) print_bin_expr(node->as.multi.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.multi.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.multi.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        case BIN_EXPR_DIVIDE:
-            printf("/\n");
-            if (node->as.divide.lhs.type == BIN_EXPR) print_bin_expr(node->as.divide.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.divide.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.divide.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.divide.rhs.type == BIN_EXPR) print_bin_expr(node->as.divide.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.divide.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.divide.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        /* NEW: equality / relational / logical ops (use binop union) */
-        case BIN_EXPR_EQ:
-            printf("==\n");
-            if (node->as.binop.lhs.type == BIN_EXPR) print_bin_expr(node->as.binop.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.binop.rhs.type == BIN_EXPR) print_bin_expr(node->as.binop.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        case BIN_EXPR_NEQ:
-            printf("!=\n");
-            if (node->as.binop.lhs.type == BIN_EXPR) print_bin_expr(node->as.binop.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.binop.rhs.type == BIN_EXPR) print_bin_expr(node->as.binop.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        case BIN_EXPR_LT:
-            printf("<\n");
-            if (node->as.binop.lhs.type == BIN_EXPR) print_bin_expr(node->as.binop.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.binop.rhs.type == BIN_EXPR) print_bin_expr(node->as.binop.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        case BIN_EXPR_LTE:
-            printf("<=\n");
-            if (node->as.binop.lhs.type == BIN_EXPR) print_bin_expr(node->as.binop.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.binop.rhs.type == BIN_EXPR) print_bin_expr(node->as.binop.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        case BIN_EXPR_MR:
-            printf(">\n");
-            if (node->as.binop.lhs.type == BIN_EXPR) print_bin_expr(node->as.binop.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.binop.rhs.type == BIN_EXPR) print_bin_expr(node->as.binop.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        case BIN_EXPR_MRE:
-            printf(">=\n");
-            if (node->as.binop.lhs.type == BIN_EXPR) print_bin_expr(node->as.binop.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.binop.rhs.type == BIN_EXPR) print_bin_expr(node->as.binop.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        case BIN_EXPR_AND:
-            printf("&&\n");
-            if (node->as.binop.lhs.type == BIN_EXPR) print_bin_expr(node->as.binop.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.binop.rhs.type == BIN_EXPR) print_bin_expr(node->as.binop.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        case BIN_EXPR_OR:
-            printf("||\n");
-            if (node->as.binop.lhs.type == BIN_EXPR) print_bin_expr(node->as.binop.lhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.lhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.lhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_LHS_TYPE\n");
-            }
-            if (node->as.binop.rhs.type == BIN_EXPR) print_bin_expr(node->as.binop.rhs.as.bin_expr, depth + 1);
-            else {
-                for (int i = 0; i < depth + 1; i++) printf("-");
-                if (node->as.binop.rhs.type == NODE_EXPR) {
-                    NodeExpr *n = node->as.binop.rhs.as.node_expr;
-                    if (n) {
-                        if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", n->as.int_lit.int_lit.value);
-                        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", n->as.ident.ident.value);
-                        else printf("NODE(kind=%d)\n", n->kind);
-                    } else printf("NODE(NULL)\n");
-                } else printf("UNKNOWN_RHS_TYPE\n");
-            }
-            break;
-
-        default:
-            printf("UNKNOWN_BIN_KIND(%d)\n", node->kind);
-            break;
+static const char* bin_op_name(BinExprKind kind) {
+    switch (kind) {
+        case BIN_EXPR_ADD:    return "+";
+        case BIN_EXPR_MINUS:  return "-";
+        case BIN_EXPR_MULTI:  return "*";
+        case BIN_EXPR_DIVIDE: return "/";
+        case BIN_EXPR_EQ:     return "==";
+        case BIN_EXPR_NEQ:    return "!=";
+        case BIN_EXPR_LT:     return "<";
+        case BIN_EXPR_LTE:    return "<=";
+        case BIN_EXPR_MR:     return ">";
+        case BIN_EXPR_MRE:    return ">=";
+        case BIN_EXPR_AND:    return "&&";
+        case BIN_EXPR_OR:     return "||";
+        default:              return NULL;
     }
-
 }
 
-// ---- Parse binary statement ----
-OptionalBinExpr parse_bin_stmt(Parser_data* p) {
-    OptionalBinExpr res = {0};
+typedef struct PrintItem {
+    ExprId id;
+    int depth;
+} PrintItem;
 
-    OptionalNodeExpr expr_opt = parse_expr_to_terminator(p);
-    if (!expr_opt.has_value) {
-        res.has_value = 0;
-        return res;
-    }
+// pre-order with an explicit stack, deep trees do not recurse
+void print_bin_expr(const NodeProg* ast, const BinExpr* node, int depth) {
+    if (!node) return;
 
-    // only accept binary expression results
-    if (expr_opt.value.kind != NODE_EXPR_BIN || expr_opt.value.as.bin == NULL) {
-        res.has_value = 0;
-        return res;
+    kvec_t(PrintItem) todo;
+    kv_init(todo);
+    const BinExpr* bin = node;
+    while (1) {
+        if (bin) {
+            for (int i = 0; i < depth; i++) printf("-");
+            const char* op = bin_op_name(bin->kind);
+            if (!op) {
+                printf("UNKNOWN_BIN_KIND(%d)\n", bin->kind);
+            } else {
+                printf("%s\n", op);
+                PrintItem rhs = { bin->rhs, depth + 1 };
+                PrintItem lhs = { bin->lhs, depth + 1 };
+                kv_push(PrintItem, todo, rhs);
+                kv_push(PrintItem, todo, lhs);
+            }
+        }
+        if (kv_size(todo) == 0) break;
+
+        PrintItem item = kv_pop(todo);
+        const NodeExpr* n = ast_expr(ast, item.id);
+        depth = item.depth;
+        bin = NULL;
+        if (n && n->kind == NODE_EXPR_BIN) {
+            bin = &n->as.bin;
+            continue;
+        }
+        for (int i = 0; i < depth; i++) printf("-");
+        if (!n) printf("NODE(NULL)\n");
+        else if (n->kind == NODE_EXPR_INT_LIT) printf("INT(%s)\n", token_value(ast_tok(ast, n->as.int_lit.int_lit)));
+        else if (n->kind == NODE_EXPR_IDENT) printf("IDENT(%s)\n", token_value(ast_tok(ast, n->as.ident.ident)));
+        else printf("NODE(kind=%d)\n", n->kind);
     }
-
-    // copy the BinExpr value out (caller often allocates a heap NodeExpr and copies this in)
-    res.has_value = 1;
-    res.value = *(expr_opt.value.as.bin);
-    return res;
+    kv_destroy(todo);
 }
 
-
+// ---- Parse binary statement ----
 bool is_comparison_op(TokenType t) {
     return t == token_type_cmp ||
            t == token_type_less ||
@@ -435,551 +334,781 @@ bool is_comparison_op(TokenType t) {
 }
 
 // ---- Parse expression ----
-OptionalNodeExpr parse_expr(Parser_data* p) {
-    OptionalNodeExpr result = {0};
-    OptionalToken t = parser_peek(p, 0);
-    if (!t.has_value) return result;
-    if ((t.value.type == token_type_int_lit || t.value.type == token_type_char_v) || t.value.type == token_type_ident) {
-        OptionalToken t1 = parser_peek(p, 1);
-        OptionalToken t2 = parser_peek(p, 2);
-
-        // we have function
-        if (t1.has_value && t1.value.type == token_type_open_paren) {
-            NodeExpr res;
-            NodeExprFunc ImSorry;
-            Token name = parser_consume(p);
-            if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_paren)) {
-                fprintf(stderr,"Expected '('\n"); exit(1);
-            }
-            parser_consume(p); // (
-            TokenArray args;
-            kv_init(args);
-            while (parser_peek(p, 0).value.type != token_type_close_paren) {
-                Token arg = parser_consume(p);
-                kv_push(Token, args, arg);
-                if (parser_peek(p, 0).has_value && parser_peek(p,0).value.type == token_type_comma) {
-                    parser_consume(p);
-                    continue;
-                }
-                break;
-                }
-            if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_paren)) {
-                printf("m_index: %d\n", p->m_index);
-                fprintf(stderr,"Expected ')'\n"); exit(1);
-            }
-            parser_consume(p); // )
-            res.kind = NODE_EXPR_FUNC;
-            ImSorry.name = name;
-            ImSorry.args = args;
-            res.as.func = ImSorry;
-            result.value = res;
-            result.has_value = 1;
-            return result;
-        }
-
-        // so we check if in expr second token is some operation and it has left and right
-        if (t1.has_value && t2.has_value &&
-            (t1.value.type == token_type_plus || t1.value.type == token_type_minus ||
-             t1.value.type == token_type_multi || t1.value.type == token_type_divide) &&
-            ((t2.value.type == token_type_int_lit || t2.value.type == token_type_int_lit) || t2.value.type == token_type_ident)) {
-
-            OptionalBinExpr bin = parse_bin_stmt(p);
-            if (!bin.has_value) {
-                return result;
-            }
-
-            NodeExpr* expr_heap = (NodeExpr*)malloc(sizeof(NodeExpr));
-            if (!expr_heap) { fprintf(stderr,"Out of memory\n"); exit(1); }
-            expr_heap->kind = NODE_EXPR_BIN;
-            expr_heap->as.bin = (BinExpr*)malloc(sizeof(BinExpr));
-            if (!expr_heap->as.bin) { fprintf(stderr,"Out of memory\n"); exit(1); }
-            *expr_heap->as.bin = bin.value;
-
-            result.has_value = 1;
-            result.value = *expr_heap;
-
-
-            print_bin_expr(expr_heap->as.bin, 0);
-            return result;
-        }
-        // we have like x == 5
-        if (t1.has_value && is_comparison_op(t1.value.type)) {
-            OptionalBinExpr bin = parse_bin_stmt(p);
-            if (!bin.has_value) {
-                return result;
-            }
-
-            NodeExpr* expr_heap = (NodeExpr*)malloc(sizeof(NodeExpr));
-            if (!expr_heap) { fprintf(stderr,"Out of memory\n"); exit(1); }
-            expr_heap->kind = NODE_EXPR_BIN;
-            expr_heap->as.bin = (BinExpr*)malloc(sizeof(BinExpr));
-            if (!expr_heap->as.bin) { fprintf(stderr,"Out of memory\n"); exit(1); }
-            *expr_heap->as.bin = bin.value;
-
-            result.has_value = 1;
-            result.value = *expr_heap;
-
-            print_bin_expr(expr_heap->as.bin, 0);
-            return result;
-        }
-        else {
-            NodeExpr expr;
-
-            if (t.value.type == token_type_int_lit) {
-                expr.kind = NODE_EXPR_INT_LIT;
-                expr.as.int_lit.int_lit = parser_consume(p);
-            } else if (t.value.type == token_type_char_v) {
-                expr.kind = NODE_EXPR_CHAR;
-                expr.as.char_.char_ = parser_consume(p);
-            } else {
-                expr.kind = NODE_EXPR_IDENT;
-                expr.as.ident.ident = parser_consume(p);
-            }
-            result.has_value = 1;
-            result.value = expr;
-            return result;
-        }
+ExprId parse_expr(Parser_data* p) {
+    TokenType t = parser_peek_kind(p, 0);
+    if (t != token_type_int_lit && t != token_type_char_v &&
+        t != token_type_ident && t != token_type_open_paren) {
+        return AST_NONE;
     }
-    return result;
+
+    // leaf, call or binary expression in one pass, the end of the
+    // expression is wherever the Pratt parser stops. the postfix code is
+    // written alongside the tree
+    ExprCode code;
+    code.ops.start = (uint32_t)kv_size(p->m_ast->rpn);
+    code.root = parse_expr_prec(p, 0);
+    code.ops.count = (uint32_t)kv_size(p->m_ast->rpn) - code.ops.start;
+    kv_push(ExprCode, p->m_ast->codes, code);
+
+#ifdef DUMP_AST
+    // debug only: the dump is as long as the tree is deep times wide
+    const NodeExpr* expr = ast_expr(p->m_ast, code.root);
+    if (expr->kind == NODE_EXPR_BIN) print_bin_expr(p->m_ast, &expr->as.bin, 0);
+#endif
+    return code.root;
 }
 
 // ---- Parse statement ----
-OptionalNodeStmt parse_stmt(Parser_data* p) {
-    OptionalNodeStmt result = {0};
-
-
-
+// parse_stmt_head() result for a statement whose body was opened with '{'
+// and is still to be parsed, the statement itself is left in *open
+#define STMT_OPEN (AST_NONE - 1)
+
+static StmtId parse_stmt_head(Parser_data* p, NodeStmt* open);
+
+// init and step of a for header, these can not open a body
+static StmtId parse_for_clause(Parser_data* p) {
+    NodeStmt open;
+    StmtId id = parse_stmt_head(p, &open);
+    if (id == STMT_OPEN) parser_error(p, "Expected a simple statement in for header");
+    return id;
+}
 
-    OptionalToken t0 = parser_peek(p, 0);
+static StmtId parse_stmt_head(Parser_data* p, NodeStmt* open) {
+    NodeStmt node_stmt;
+    TokenType t0 = parser_peek_kind(p, 0);
 
 
-    if (t0.has_value && t0.value.type == token_type_return) {
+    if (t0 == token_type_return) {
         parser_consume(p); // return
-        NodeStmt res;
-        NodeStmtReturn return_;
-        OptionalNodeExpr expr = parse_expr(p);
-        if (expr.has_value) {
-            return_.res = expr.value;
-        }
-        res.kind = NODE_STMT_RETURN;
-        res.as.return_ = return_;
-        result.has_value = 1;
-        result.value = res;
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_semi)) {
-            fprintf(stderr,"Expected ';'\n"); exit(1);
+        node_stmt.kind = NODE_STMT_RETURN;
+        node_stmt.as.return_.res = parse_expr(p);
+        if (parser_peek_kind(p, 0) != token_type_semi) {
+            parser_error(p, "Expected ';'");
         }
         parser_consume(p);
-        return result;
+        return ast_push_stmt(p->m_ast, node_stmt);
     }
 
-    if (t0.has_value && t0.value.type == token_type_exit_kw) {
+    if (t0 == token_type_exit_kw) {
         parser_consume(p); // consume exit
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_paren)) {
-            fprintf(stderr,"Expected '('\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_open_paren) {
+            parser_error(p, "Expected '('");
         }
         parser_consume(p); // (
-        NodeStmtExit stmt_exit;
         // parsing expr inside parentheses
-        OptionalNodeExpr expr = parse_expr(p);
-        if (!expr.has_value) { fprintf(stderr,"Invalid expression after exit\n"); exit(1); }
-        stmt_exit.expr = expr.value;
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_paren)) {
-            printf("m_index: %d\n", p->m_index);
-            fprintf(stderr,"Expected ')'\n"); exit(1);
+        ExprId expr = parse_expr(p);
+        if (expr == AST_NONE) { parser_error(p, "Invalid expression after exit"); }
+        if (parser_peek_kind(p, 0) != token_type_close_paren) {
+            parser_error(p, "Expected ')'");
         }
         parser_consume(p);
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_semi)) {
-            fprintf(stderr,"Expected ';'\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_semi) {
+            parser_error(p, "Expected ';'");
         }
         parser_consume(p);
-        NodeStmt node_stmt;
         node_stmt.kind = NODE_STMT_EXIT;
-        node_stmt.as.exit_ = stmt_exit;
-        result.has_value = 1;
-        result.value = node_stmt;
-        return result;
+        node_stmt.as.exit_.expr = expr;
+        return ast_push_stmt(p->m_ast, node_stmt);
     }
 
-    OptionalToken t1 = parser_peek(p, 1);
-    OptionalToken t2 = parser_peek(p, 2);
+    TokenType t1 = parser_peek_kind(p, 1);
+    TokenType t2 = parser_peek_kind(p, 2);
 
-    if(t0.has_value && t0.value.type == token_type_ident &&
-        t1.has_value && t1.value.type == token_type_open_paren) {
+    if(t0 == token_type_ident &&
+        t1 == token_type_open_paren) {
             // func call
-
-            NodeStmt i_tired_of_this;
-            NodeStmtFunCall nigger;
-            TokenArray args;
-            kv_init(args);
-            Token name = parser_consume(p);
-            if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_paren)) {
-                printf("m_index: %d\n", p->m_index);
-                fprintf(stderr,"Expected '('\n"); exit(1);
-            }
-            parser_consume(p);
-            for (int i = 0; parser_peek(p, 0).value.type != token_type_close_paren; i++) {
-                Token arg = parser_consume(p);
-                kv_push(Token, args, arg);
-                if (parser_peek(p, 0).has_value && parser_peek(p,0).value.type == token_type_comma) {
+            TokId name = ast_push_tok(p->m_ast, parser_consume(p));
+            parser_consume(p); // (
+            size_t mark = list_begin(p);
+            while (parser_peek_kind(p, 0) != token_type_close_paren) {
+                if (parser_peek_kind(p, 0) == token_empty) break;
+                list_add(p, ast_push_tok(p->m_ast, parser_consume(p)));
+                if (parser_peek_kind(p, 0) == token_type_comma) {
                     parser_consume(p);
                     continue;
                 }
                 break;
-                }
-            if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_paren)) {
-                printf("m_index: %d\n", p->m_index);
-                fprintf(stderr,"Expected ')'\n"); exit(1);
-                
+            }
+            AstList args = list_end(p, mark);
+            if (parser_peek_kind(p, 0) != token_type_close_paren) {
+                parser_error(p, "Expected ')'");
             }
             parser_consume(p);
-            if (parser_peek(p,0).has_value && parser_peek(p, 0).value.type != token_type_close_paren) {
-                if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_semi)) {
-                    printf("am_index: %d\n", p->m_index);
-                    fprintf(stderr,"Expected ';'\n"); exit(1);
-                    
+            if (parser_peek_kind(p, 0) != token_empty && parser_peek_kind(p, 0) != token_type_close_paren) {
+                if (parser_peek_kind(p, 0) != token_type_semi) {
+                    parser_error(p, "Expected ';'");
                 }
                 parser_consume(p);
             }
-            nigger.name = name;
-            nigger.args = args;
-            i_tired_of_this.kind = NODE_STMT_FUNC_USE;
-            i_tired_of_this.as.func_call = nigger;
-            result.value = i_tired_of_this;
-            result.has_value = 1;
-            return result;
+            node_stmt.kind = NODE_STMT_FUNC_USE;
+            node_stmt.as.func_call.name = name;
+            node_stmt.as.func_call.args = args;
+            return ast_push_stmt(p->m_ast, node_stmt);
         }
 
 
-    if (t0.has_value && is_type(t0.value.type) 
-        && t1.has_value && t1.value.type == token_type_ident
-        && t2.has_value && t2.value.type == token_type_open_paren) {
+    if (is_type(t0) 
+        && t1 == token_type_ident
+        && t2 == token_type_open_paren) {
             // func init
-            
-            NodeStmt res;
-            res.kind = NODE_STMT_FUNC;
-
-            Args func_types;
-            kv_init(func_types);
-
-            Token type = parser_consume(p);
-            Token name = parser_consume(p);
-            
-            res.as.func.name = name;
-            res.as.func.ExpectedReturnType = type;
+            node_stmt.kind = NODE_STMT_FUNC;
+            node_stmt.as.func.ExpectedReturnType = ast_push_tok(p->m_ast, parser_consume(p));
+            node_stmt.as.func.name = ast_push_tok(p->m_ast, parser_consume(p));
+            node_stmt.as.func.body_at = AST_NONE;
+            node_stmt.as.func.body_offset = 0;
 
             parser_consume(p); // (
-            for (int i = 0; parser_peek(p, 0).value.type != token_type_close_paren; i++) {
-                Arg pair;
-                pair.pair[0] = parser_consume(p); // type
-                pair.pair[1] = parser_consume(p); // name
-                kv_push(Arg, func_types, pair);
+            size_t mark = list_begin(p);
+            while (parser_peek_kind(p, 0) != token_type_close_paren) {
+                if (parser_peek_kind(p, 0) == token_empty) break;
+                list_add(p, ast_push_tok(p->m_ast, parser_consume(p))); // type
+                list_add(p, ast_push_tok(p->m_ast, parser_consume(p))); // name
             }
-            res.as.func.types = func_types;
-            kv_init(func_types);
-            if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_paren)) {
-                printf("m_index: %d\n", p->m_index);
-                fprintf(stderr,"Expected ')'\n"); exit(1);
+            node_stmt.as.func.types = list_end(p, mark);
+            if (parser_peek_kind(p, 0) != token_type_close_paren) {
+                parser_error(p, "Expected ')'");
             }
             parser_consume(p);
-            if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_braces)) {
-                printf("m_index: %d\n", p->m_index);
-                fprintf(stderr,"Expected {'\n"); exit(1);
+            if (parser_peek_kind(p, 0) != token_type_open_braces) {
+                parser_error(p, "Expected '{'");
             }
             parser_consume(p);
-            NodeStmtArray body;
-            kv_init(body);
-            while (parser_peek(p,0).has_value && parser_peek(p,0).value.type != token_type_close_braces) {
-                OptionalNodeStmt inner = parse_stmt(p);
-                if (!inner.has_value) { fprintf(stderr,"Failed to parse statement inside function\n"); printf("m_index: %d\n", p->m_index); exit(1); }
-                kv_push(NodeStmt, body, inner.value);
-            }
-            if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_braces)) {
-                printf("m_index: %d\n", p->m_index);
-                fprintf(stderr,"Expected }'\n"); exit(1);
-            }
-            parser_consume(p);
-            res.as.func.body = body;
-            result.has_value = 1;
-            result.value = res;
-            return result;
-
-
-
+            *open = node_stmt;
+            return STMT_OPEN;
         }
 
-    if (t0.has_value && is_type(t0.value.type) &&
-        t1.has_value && t1.value.type == token_type_ident &&
-        t2.has_value && t2.value.type == token_type_eq_kw) {
+    if (is_type(t0) &&
+        t1 == token_type_ident &&
+        t2 == token_type_eq_kw) {
         Token type = parser_consume(p);
-        Token ident = parser_consume(p);
+        TokId ident = ast_push_tok(p->m_ast, parser_consume(p));
         parser_consume(p); // consume =
-        OptionalNodeExpr expr = parse_expr(p);
-        if (parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_semi) {
+        ExprId expr = parse_expr(p);
+        if (parser_peek_kind(p, 0) == token_type_semi) {
             parser_consume(p);
         } else {
-            printf("debug: m_index: %d\n", p->m_index);
-            printf("Expected ;\n");
-            exit(1);
+            parser_error(p, "Expected ';'");
         }
-        if (!expr.has_value) { fprintf(stderr,"Invalid expression after let\n"); exit(1); }
-        NodeStmt node_stmt;
+        if (expr == AST_NONE) { parser_error(p, "Invalid expression after let"); }
         if (type.type == token_type_short) {
             node_stmt.kind = NODE_STMT_SHORT;
             node_stmt.as.short_.ident = ident;
-            node_stmt.as.short_.expr = expr.value;
+            node_stmt.as.short_.expr = expr;
         } else if (type.type == token_type_long) {
             node_stmt.kind = NODE_STMT_LONG;
             node_stmt.as.long_.ident = ident;
-            node_stmt.as.long_.expr = expr.value;
+            node_stmt.as.long_.expr = expr;
         }
         else if (type.type == token_type_int) {
             node_stmt.kind = NODE_STMT_INT;
             node_stmt.as.int_.ident = ident;
-            node_stmt.as.int_.expr = expr.value;
+            node_stmt.as.int_.expr = expr;
         } else if (type.type == token_type_char_t) {
             node_stmt.kind = NODE_STMT_CHAR;
             node_stmt.as.char_.ident = ident;
-            node_stmt.as.char_.expr = expr.value;
+            node_stmt.as.char_.expr = expr;
+        } else {
+            parser_error(p, "Cannot declare a variable of type void");
         }
-        result.has_value = 1;
-        result.value = node_stmt;
-        return result;
+        return ast_push_stmt(p->m_ast, node_stmt);
     }
 
-    if (t0.has_value && t0.value.type == token_type_ident &&
-        t1.has_value && t1.value.type == token_type_eq_kw) {
-            NodeStmtVchange stmt_vchange;
-            stmt_vchange.ident = parser_consume(p);
+    if (t0 == token_type_ident &&
+        t1 == token_type_eq_kw) {
+            TokId ident = ast_push_tok(p->m_ast, parser_consume(p));
             parser_consume(p); // consume =
-            OptionalNodeExpr expr = parse_expr(p);
-            if (!(parser_peek(p,0).has_value && (parser_peek(p,0).value.type == token_type_semi || parser_peek(p,0).value.type == token_type_close_paren))) {
-                printf("m_index: %d\n", p->m_index);
-                fprintf(stderr,"Expected '; or )'\n"); exit(1);
+            ExprId expr = parse_expr(p);
+            if (!(parser_peek_kind(p, 0) == token_type_semi || parser_peek_kind(p, 0) == token_type_close_paren)) {
+                parser_error(p, "Expected '; or )'");
             }
             parser_consume(p); // '; or )'
-            if (!expr.has_value) { fprintf(stderr,"Invalid expression after let\n"); exit(1); }
-            stmt_vchange.expr = expr.value;
-            NodeStmt node_stmt;
+            if (expr == AST_NONE) { parser_error(p, "Invalid expression after let"); }
             node_stmt.kind = NODE_STMT_VCHANGE;
-            node_stmt.as.vchange = stmt_vchange;
-            result.has_value = 1;
-            result.value = node_stmt;
-            return result;
+            node_stmt.as.vchange.ident = ident;
+            node_stmt.as.vchange.expr = expr;
+            return ast_push_stmt(p->m_ast, node_stmt);
         }
 
-    if (t0.has_value && t0.value.type == token_type_if) {
+    if (t0 == token_type_if) {
         // consume 'if'
         parser_consume(p);
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_paren)) {
-            fprintf(stderr,"Expected '('\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_open_paren) {
+            parser_error(p, "Expected '('");
         }
         parser_consume(p); // '('
-        OptionalNodeExpr cond = parse_expr(p);
-        if (!cond.has_value) { fprintf(stderr,"Invalid expression in if condition\n"); exit(1); }
+        ExprId cond = parse_expr(p);
+        if (cond == AST_NONE) { parser_error(p, "Invalid expression in if condition"); }
 
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_paren)) {
-            fprintf(stderr,"Expected ')'\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_close_paren) {
+            parser_error(p, "Expected ')'");
         }
         parser_consume(p); // ')'
 
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_braces)) {
-            fprintf(stderr,"Expected '{'\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_open_braces) {
+            parser_error(p, "Expected '{'");
         }
         parser_consume(p); // '{'
 
-        // parse inner statements until closing brace
-        NodeStmtArray body = {};
-        kv_init(body);
-        while (parser_peek(p,0).has_value && parser_peek(p,0).value.type != token_type_close_braces) {
-            OptionalNodeStmt inner = parse_stmt(p);
-            if (!inner.has_value) {
-                // print context to help debugging: show current token & index
-                OptionalToken cur = parser_peek(p, 0);
-                if (cur.has_value) {
-                    fprintf(stderr, "Failed to parse statement inside if at index %d: token type=%d\n", p->m_index, cur.value.type);
-                } else {
-                    fprintf(stderr, "Failed to parse statement inside if at index %d: no token\n", p->m_index);
-                }
-                exit(1);
-            }
-            kv_push(NodeStmt, body, inner.value);
-        }
-
-
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_braces)) {
-            fprintf(stderr,"Expected '}'\n"); exit(1);
-        }
-        parser_consume(p); // '}'
-
-        NodeStmtIf n_if;
-        n_if.cond = cond.value;
-        n_if.body = body;
-
-        NodeStmt node_stmt;
         node_stmt.kind = NODE_STMT_IF;
-        node_stmt.as.if_ = n_if;
-        result.has_value = 1;
-        result.value = node_stmt;
-        return result;
+        node_stmt.as.if_.cond = cond;
+        *open = node_stmt;
+        return STMT_OPEN;
     }
-    if (t0.has_value && t0.value.type == token_type_else) {
+    if (t0 == token_type_else) {
         parser_consume(p);
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_braces)) {
-            fprintf(stderr,"Expected '{'\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_open_braces) {
+            parser_error(p, "Expected '{'");
         }
         parser_consume(p); // '{'
 
-        NodeStmtArray body;
-        kv_init(body);
-        while (parser_peek(p,0).has_value && parser_peek(p,0).value.type != token_type_close_braces) {
-            OptionalNodeStmt inner = parse_stmt(p);
-            if (!inner.has_value) { fprintf(stderr,"Failed to parse statement inside if\n"); exit(1); }
-            kv_push(NodeStmt, body, inner.value);
-        }
-        printf("m_index: %d\n", p->m_index);
-
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_braces)) {
-            fprintf(stderr,"Expected '}'\n"); exit(1);
-        }
-        parser_consume(p); // '}'
-        NodeStmtElse n_else;
-        n_else.body = body;
-        NodeStmt node_stmt;
         node_stmt.kind = NODE_STMT_ELSE;
-        node_stmt.as.else_ = n_else;
-        result.has_value = 1;
-        result.value = node_stmt;
-        printf("result: %d\n", result.has_value);
-        return result;
+        *open = node_stmt;
+        return STMT_OPEN;
     }
 
     
-    if (t0.has_value && t0.value.type == token_type_while) {
+    if (t0 == token_type_while) {
         parser_consume(p); //consume while
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_paren)) {
-            fprintf(stderr,"Expected '('\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_open_paren) {
+            parser_error(p, "Expected '('");
         }
         parser_consume(p); // '('
-        OptionalNodeExpr cond = parse_expr(p);
-        if (!cond.has_value) { fprintf(stderr,"Invalid expression in while condition\n"); exit(1); }
+        ExprId cond = parse_expr(p);
+        if (cond == AST_NONE) { parser_error(p, "Invalid expression in while condition"); }
 
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_paren)) {
-            printf("m_index: %d\n", p->m_index);
-            fprintf(stderr,"Expected ')'\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_close_paren) {
+            parser_error(p, "Expected ')'");
         }
         parser_consume(p); // ')'
 
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_braces)) {
-            fprintf(stderr,"Expected '{'\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_open_braces) {
+            parser_error(p, "Expected '{'");
         }
         parser_consume(p); // '{'
 
-        // parse inner statements until closing brace
-        NodeStmtArray body = {};
-        kv_init(body);
-        while (parser_peek(p,0).has_value && parser_peek(p,0).value.type != token_type_close_braces) {
-            OptionalNodeStmt inner = parse_stmt(p);
-            if (!inner.has_value) {
-                // print context to help debugging: show current token & index
-                OptionalToken cur = parser_peek(p, 0);
-                if (cur.has_value) {
-                    fprintf(stderr, "Failed to parse statement inside while at index %d: token type=%d\n", p->m_index, cur.value.type);
-                } else {
-                    fprintf(stderr, "Failed to parse statement inside while at index %d: no token\n", p->m_index);
-                }
-                exit(1);
-            }
-            kv_push(NodeStmt, body, inner.value);
-        }
-        printf("m_index: %d\n", p->m_index);
-
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_braces)) {
-            fprintf(stderr,"Expected '}'\n"); exit(1);
-        }
-        parser_consume(p); // '}'
-        NodeStmtWhile n_while;
-        n_while.body = body;
-        n_while.cond = cond.value;
-        NodeStmt node_stmt;
         node_stmt.kind = NODE_STMT_WHILE;
-        node_stmt.as.while_ = n_while;
-        result.has_value = 1;
-        result.value = node_stmt;
-        printf("result: %d\n", result.has_value);
-        return result;
+        node_stmt.as.while_.cond = cond;
+        *open = node_stmt;
+        return STMT_OPEN;
     }
-    if (t0.has_value && t0.value.type == token_type_for) {
+    if (t0 == token_type_for) {
         parser_consume(p); // for 
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_paren)) {
-            fprintf(stderr,"Expected '('\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_open_paren) {
+            parser_error(p, "Expected '('");
         }
         parser_consume(p); // '('
-        OptionalNodeStmt cond1 = parse_stmt(p);
-        OptionalNodeExpr cond2 = parse_expr(p);
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_semi)) {
-            fprintf(stderr,"Expected ';'\n"); exit(1);
+        node_stmt.kind = NODE_STMT_FOR;
+        node_stmt.as.for_.cond1 = parse_for_clause(p); // local for var init
+        node_stmt.as.for_.cond2 = parse_expr(p); // stop logic operation
+        if (parser_peek_kind(p, 0) != token_type_semi) {
+            parser_error(p, "Expected ';'");
         }
         parser_consume(p);
-        OptionalNodeStmt cond3 = parse_stmt(p);
+        node_stmt.as.for_.cond3 = parse_for_clause(p); // expr that goes every iteration
 
         // no checking for ) cause it checking in conditions  
 
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_open_braces)) {
-            fprintf(stderr,"Expected '{'\n"); exit(1);
+        if (parser_peek_kind(p, 0) != token_type_open_braces) {
+            parser_error(p, "Expected '{'");
         }
         parser_consume(p); // '{'
 
-        NodeStmtArray body = {};
-        kv_init(body);
-        while (parser_peek(p,0).has_value && parser_peek(p,0).value.type != token_type_close_braces) {
-            printf("m_index: %d\n", p->m_index);
-            OptionalNodeStmt inner = parse_stmt(p);
-            if (!inner.has_value) {
-                // print context to help debugging: show current token & index
-                OptionalToken cur = parser_peek(p, 0);
-                if (cur.has_value) {
-                    fprintf(stderr, "Failed to parse statement inside for at index %d: token type=%d\n", p->m_index, cur.value.type);
-                } else {
-                    fprintf(stderr, "Failed to parse statement inside for at index %d: no token\n", p->m_index);
-                }
-                exit(1);
+        *open = node_stmt;
+        return STMT_OPEN;
+    }
+
+    return AST_NONE;
+}
+
+
+// body of a block statement, filled in when its '}' is reached
+static AstList* stmt_body(NodeStmt* stmt) {
+    switch (stmt->kind) {
+        case NODE_STMT_IF:    return &stmt->as.if_.body;
+        case NODE_STMT_ELSE:  return &stmt->as.else_.body;
+        case NODE_STMT_WHILE: return &stmt->as.while_.body;
+        case NODE_STMT_FOR:   return &stmt->as.for_.body;
+        default:              return &stmt->as.func.body;
+    }
+}
+
+static const char* stmt_block_name(NodeStmtKind kind) {
+    switch (kind) {
+        case NODE_STMT_IF:    return "if";
+        case NODE_STMT_ELSE:  return "else";
+        case NODE_STMT_WHILE: return "while";
+        case NODE_STMT_FOR:   return "for";
+        default:              return "function";
+    }
+}
+
+typedef struct OpenBlock {
+    NodeStmt stmt; // header parsed, body pending
+    size_t mark;   // start of its body on the scratch list
+} OpenBlock;
+
+// ---- Skipping function bodies ----
+// past the matching '}' without building anything, the body is parsed later
+// from where it starts if something calls the function
+static StmtId skip_func_body(Parser_data* p, NodeStmt* func) {
+    OptionalToken first = parser_peek(p, 0);
+    func->as.func.body_at = (uint32_t)p->m_index;
+    func->as.func.body_offset = first.has_value ? first.value.offset : 0;
+    func->as.func.body.start = 0;
+    func->as.func.body.count = 0;
+
+    size_t depth = 1;
+    while (depth > 0) {
+        TokenType t = parser_peek_kind(p, 0);
+        if (t == token_empty) parser_error(p, "Expected '}'");
+        if (t == token_type_open_braces) depth++;
+        else if (t == token_type_close_braces) depth--;
+        if (p->m_lexer) parser_consume(p);
+        else p->m_index++;
+    }
+    return ast_push_stmt(p->m_ast, *func);
+}
+
+// statements up to where root (or, without one, the first statement) ends.
+// bodies do not recurse: every block that is open sits on a heap stack, so
+// nesting depth is only bounded by memory. a root block gets its body filled
+// in instead of being pushed
+static StmtId parse_blocks(Parser_data* p, OpenBlock* root) {
+    kvec_t(OpenBlock) open;
+    kv_init(open);
+    if (root) kv_push(OpenBlock, open, *root);
+    StmtId result = AST_NONE;
+
+    while (1) {
+        if (kv_size(open) > 0) {
+            TokenType t = parser_peek_kind(p, 0);
+            if (t == token_type_close_braces) {
+                parser_consume(p); // '}'
+                OpenBlock* top = &kv_A(open, kv_size(open) - 1);
+                *stmt_body(&top->stmt) = list_end(p, top->mark);
+                if (root && kv_size(open) == 1) { *root = *top; break; }
+                StmtId done = ast_push_stmt(p->m_ast, top->stmt);
+                open.n--;
+                if (kv_size(open) == 0) { result = done; break; }
+                list_add(p, done);
+                continue;
             }
-            printf("m_index22: %d\n", p->m_index);
-            kv_push(NodeStmt, body, inner.value);
-        }
-        if (!(parser_peek(p,0).has_value && parser_peek(p,0).value.type == token_type_close_braces)) {
-            fprintf(stderr,"Expected '}'\n"); exit(1);
-        }
-        parser_consume(p); // '}'
-        NodeStmtFor n_for;
-        n_for.body = body;
-        n_for.cond1 = malloc(sizeof(NodeStmt));
-        *n_for.cond1 = cond1.value;
-        n_for.cond2 = cond2.value; // stop logic operation
-        n_for.cond3 = malloc(sizeof(NodeStmt)); // expr that goes every iteration
-        *n_for.cond3 = cond3.value;
-        NodeStmt node_stmt;
-        node_stmt.kind = NODE_STMT_FOR;
-        node_stmt.as.for_ = n_for;
-        result.has_value = 1;
-        result.value = node_stmt;
-        return result;
+            if (t == token_empty) parser_error(p, "Expected '}'");
+        }
+
+        OpenBlock block;
+        StmtId id = parse_stmt_head(p, &block.stmt);
+        if (id == STMT_OPEN) {
+            if (kv_size(open) == 0 && p->m_lazy && block.stmt.kind == NODE_STMT_FUNC) {
+                result = skip_func_body(p, &block.stmt);
+                break;
+            }
+            block.mark = list_begin(p);
+            kv_push(OpenBlock, open, block);
+            continue;
+        }
+        if (kv_size(open) == 0) { result = id; break; }
+        if (id == AST_NONE) {
+            parser_error(p, "Failed to parse statement inside %s (token type %d)",
+                         stmt_block_name(kv_A(open, kv_size(open) - 1).stmt.kind), parser_peek_kind(p, 0));
+        }
+        list_add(p, id);
     }
 
+    kv_destroy(open);
     return result;
 }
 
+// one statement including everything nested in it
+StmtId parse_stmt(Parser_data* p) {
+    return parse_blocks(p, NULL);
+}
+
+// ---- Lazy function bodies ----
+// top-level code is reachable. every call in it, and in the bodies parsed
+// because of it, pulls in the bodies of the functions with that name. new
+// statements and expressions only ever go to the end of the tables, so one
+// pass over each table finds every call
+
+KHASHL_MAP_INIT(KH_LOCAL, pending_map_t, pending_map, Symbol, uint32_t, kh_hash_uint32, kh_eq_generic)
+
+typedef struct PendingFunc {
+    StmtId stmt;
+    uint32_t next; // older function of the same name, AST_NONE at the end
+} PendingFunc;
+
+typedef struct LazyBodies {
+    pending_map_t* by_name; // name -> newest entry in funcs
+    kvec_t(PendingFunc) funcs;
+} LazyBodies;
+
+static void parse_func_body(Parser_data* p, StmtId id) {
+    Parser_data* sub;
+    if (p->m_lexer) {
+        StringView src = { (char*)p->m_lexer->m_src, p->m_lexer->m_src_len };
+        Token_data* lexer = tokenizer_create(src);
+        if (!lexer) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        lexer->m_index = ast_stmt(p->m_ast, id)->as.func.body_offset;
+        sub = init_parser_stream(lexer, p->m_lines);
+    } else {
+        sub = init_parser(p->m_tokens, p->m_lines);
+    }
+    if (!sub) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    sub->m_ast = p->m_ast;
+    sub->m_index = (int)ast_stmt(p->m_ast, id)->as.func.body_at;
+
+    OpenBlock root = { *ast_stmt(p->m_ast, id), list_begin(sub) };
+    parse_blocks(sub, &root);
+    root.stmt.as.func.body_at = AST_NONE;
+    *ast_stmt(p->m_ast, id) = root.stmt;
+
+    kv_destroy(sub->m_scratch);
+    if (sub->m_lexer) {
+        free(sub->m_lexer);
+        free(sub->m_ring);
+    }
+    free(sub);
+}
+
+static void call_func(Parser_data* p, LazyBodies* lazy, TokId name) {
+    pending_map_t* h = lazy->by_name;
+    khint_t k = pending_map_get(h, ast_tok(p->m_ast, name).sym);
+    if (k == kh_end(h)) return;
+    uint32_t i = kh_val(h, k);
+    pending_map_del(h, k);
+    for (; i != AST_NONE; i = kv_A(lazy->funcs, i).next) {
+        parse_func_body(p, kv_A(lazy->funcs, i).stmt);
+    }
+}
+
+static void parse_reachable_bodies(Parser_data* p, AstList top) {
+    NodeProg* ast = p->m_ast;
+    LazyBodies lazy;
+    lazy.by_name = pending_map_init();
+    kv_init(lazy.funcs);
+
+    for (uint32_t i = 0; i < top.count; i++) {
+        StmtId id = ast_list_at(ast, top, i);
+        const NodeStmt* stmt = ast_stmt(ast, id);
+        if (!ast_body_pending(stmt)) continue;
+        int absent;
+        khint_t k = pending_map_put(lazy.by_name, ast_tok(ast, stmt->as.func.name).sym, &absent);
+        PendingFunc f = { id, absent ? AST_NONE : kh_val(lazy.by_name, k) };
+        kh_val(lazy.by_name, k) = (uint32_t)kv_size(lazy.funcs);
+        kv_push(PendingFunc, lazy.funcs, f);
+    }
+
+    size_t next_stmt = 0, next_expr = 0;
+    while (kh_size(lazy.by_name) > 0
+           && (next_stmt < kv_size(ast->stmts) || next_expr < kv_size(ast->exprs))) {
+        for (; next_stmt < kv_size(ast->stmts); next_stmt++) {
+            const NodeStmt* stmt = &kv_A(ast->stmts, next_stmt);
+            if (stmt->kind == NODE_STMT_FUNC_USE) call_func(p, &lazy, stmt->as.func_call.name);
+        }
+        for (; next_expr < kv_size(ast->exprs); next_expr++) {
+            const NodeExpr* expr = &kv_A(ast->exprs, next_expr);
+            if (expr->kind == NODE_EXPR_FUNC) call_func(p, &lazy, expr->as.func.name);
+        }
+    }
+
+    pending_map_destroy(lazy.by_name);
+    kv_destroy(lazy.funcs);
+}
+
 
 // ---- Parse program ----
+// top-level statements up to the end of the parser's tokens
+static AstList parse_stmt_list(Parser_data* p) {
+    size_t mark = list_begin(p);
+    while (parser_peek_kind(p, 0) != token_empty) {
+        StmtId stmt = parse_stmt(p);
+        if (stmt == AST_NONE) parser_error(p, "Failed to parse statement");
+        list_add(p, stmt);
+    }
+    return list_end(p, mark);
+}
+
 OptionalNodeProg parse_prog(Parser_data* p) {
     OptionalNodeProg result = {0};
-    kv_init(result.value.stmt);
-    while (parser_peek(p,0).has_value) {
-        OptionalNodeStmt stmt = parse_stmt(p);
-        if (!stmt.has_value) { fprintf(stderr,"Failed to parse statement\n"); printf("m_index: %d\n", p->m_index); exit(1); }
-        kv_push(NodeStmt, result.value.stmt, stmt.value);
+    ast_init(&result.value);
+    p->m_ast = &result.value;
+
+    result.value.stmt = parse_stmt_list(p);
+    if (p->m_lazy) parse_reachable_bodies(p, result.value.stmt);
+
+    p->m_ast = NULL;
+    result.has_value = 1;
+    return result;
+}
+
+// ---- Merging ASTs ----
+typedef struct AstOffsets {
+    uint32_t stmt, expr, tok, list, rpn;
+} AstOffsets;
+
+static inline uint32_t rebase(uint32_t id, uint32_t by) {
+    return id == AST_NONE ? id : id + by;
+}
+
+// list entries are StmtIds or TokIds depending on who owns the list, every
+// list has exactly one owner which shifts it
+static AstList rebase_list(NodeProg* dst, AstList l, uint32_t list_off, uint32_t id_off) {
+    l.start += list_off;
+    for (uint32_t i = 0; i < l.count; i++) dst->lists.a[l.start + i] += id_off;
+    return l;
+}
+
+// append every table of src to dst with ids shifted into dst's id space.
+// src's top-level list is not carried over
+static AstOffsets ast_append(NodeProg* dst, const NodeProg* src) {
+    AstOffsets off;
+    off.stmt = (uint32_t)kv_size(dst->stmts);
+    off.expr = (uint32_t)kv_size(dst->exprs);
+    off.tok = (uint32_t)kv_size(dst->toks);
+    off.list = (uint32_t)kv_size(dst->lists);
+    off.rpn = (uint32_t)kv_size(dst->rpn);
+
+    for (size_t i = 0; i < kv_size(src->toks); i++) kv_push(Token, dst->toks, kv_A(src->toks, i));
+    for (size_t i = 0; i < kv_size(src->lists); i++) kv_push(uint32_t, dst->lists, kv_A(src->lists, i));
+
+    for (size_t i = 0; i < kv_size(src->exprs); i++) {
+        NodeExpr e = kv_A(src->exprs, i);
+        switch (e.kind) {
+            case NODE_EXPR_INT_LIT: e.as.int_lit.int_lit += off.tok; break;
+            case NODE_EXPR_IDENT:   e.as.ident.ident += off.tok; break;
+            case NODE_EXPR_CHAR:    e.as.char_.char_ += off.tok; break;
+            case NODE_EXPR_FUNC:
+                e.as.func.name += off.tok;
+                e.as.func.args = rebase_list(dst, e.as.func.args, off.list, off.tok);
+                break;
+            case NODE_EXPR_BIN:
+                e.as.bin.lhs += off.expr;
+                e.as.bin.rhs += off.expr;
+                break;
+            default: break;
+        }
+        kv_push(NodeExpr, dst->exprs, e);
+    }
+
+    for (size_t i = 0; i < kv_size(src->stmts); i++) {
+        NodeStmt st = kv_A(src->stmts, i);
+        switch (st.kind) {
+            case NODE_STMT_EXIT: st.as.exit_.expr = rebase(st.as.exit_.expr, off.expr); break;
+            case NODE_STMT_CHAR:
+            case NODE_STMT_INT:
+            case NODE_STMT_SHORT:
+            case NODE_STMT_LONG:
+            case NODE_STMT_VCHANGE:
+                // same {ident, expr} layout for all of them
+                st.as.int_.ident += off.tok;
+                st.as.int_.expr = rebase(st.as.int_.expr, off.expr);
+                break;
+            case NODE_STMT_IF:
+                st.as.if_.cond += off.expr;
+                st.as.if_.body = rebase_list(dst, st.as.if_.body, off.list, off.stmt);
+                break;
+            case NODE_STMT_ELSE:
+                st.as.else_.body = rebase_list(dst, st.as.else_.body, off.list, off.stmt);
+                break;
+            case NODE_STMT_WHILE:
+                st.as.while_.cond += off.expr;
+                st.as.while_.body = rebase_list(dst, st.as.while_.body, off.list, off.stmt);
+                break;
+            case NODE_STMT_FOR:
+                st.as.for_.cond1 = rebase(st.as.for_.cond1, off.stmt);
+                st.as.for_.cond2 = rebase(st.as.for_.cond2, off.expr);
+                st.as.for_.cond3 = rebase(st.as.for_.cond3, off.stmt);
+                st.as.for_.body = rebase_list(dst, st.as.for_.body, off.list, off.stmt);
+                break;
+            case NODE_STMT_FUNC_USE:
+                st.as.func_call.name += off.tok;
+                st.as.func_call.args = rebase_list(dst, st.as.func_call.args, off.list, off.tok);
+                break;
+            case NODE_STMT_FUNC:
+                st.as.func.name += off.tok;
+                st.as.func.ExpectedReturnType = rebase(st.as.func.ExpectedReturnType, off.tok);
+                st.as.func.body = rebase_list(dst, st.as.func.body, off.list, off.stmt);
+                st.as.func.types = rebase_list(dst, st.as.func.types, off.list, off.tok);
+                break;
+            case NODE_STMT_RETURN:
+                st.as.return_.res = rebase(st.as.return_.res, off.expr);
+                break;
+        }
+        kv_push(NodeStmt, dst->stmts, st);
+    }
+
+    for (size_t i = 0; i < kv_size(src->rpn); i++) {
+        RpnOp op = kv_A(src->rpn, i);
+        op.expr = rebase(op.expr, off.expr);
+        kv_push(RpnOp, dst->rpn, op);
+    }
+    // roots stay sorted: everything appended is above what dst had
+    for (size_t i = 0; i < kv_size(src->codes); i++) {
+        ExprCode code = kv_A(src->codes, i);
+        code.root += off.expr;
+        code.ops.start += off.rpn;
+        kv_push(ExprCode, dst->codes, code);
+    }
+    return off;
+}
+
+// ---- Parallel parsing of top-level functions ----
+// a scan over the token kinds cuts the program at top-level function
+// definitions. every function, and every run of other top-level statements
+// between two of them, is a segment that parses on its own. workers take
+// segments from a shared counter and parse them into their own NodeProg, the
+// pieces are appended afterwards and the top-level list is put back in source order.
+
+typedef struct ParseSegment {
+    size_t start, end; // token range
+    int is_func;
+    int worker;        // who parsed it
+    AstList stmts;     // its top-level statements, in the worker's id space
+} ParseSegment;
+
+typedef kvec_t(ParseSegment) ParseSegments;
+
+typedef struct ParseWorker {
+    const TokenStore* tokens;
+    SourceLines* lines;
+    ParseSegments* segs;
+    atomic_size_t* next;
+    int id;
+    NodeProg ast;
+} ParseWorker;
+
+static void push_segment(ParseSegments* segs, size_t start, size_t end, int is_func) {
+    if (start >= end) return;
+    ParseSegment seg = { start, end, is_func, 0, { 0, 0 } };
+    kv_push(ParseSegment, *segs, seg);
+}
+
+// only looks at kinds and braces, a malformed function ends up in one
+// segment and the parser reports it from there
+static void find_segments(const TokenStore* t, ParseSegments* segs) {
+    size_t n = t->n, gap = 0, depth = 0;
+    for (size_t i = 0; i < n; i++) {
+        TokenType k = token_store_kind(t, i);
+        if (depth == 0 && is_type(k) && i + 2 < n
+            && token_store_kind(t, i + 1) == token_type_ident
+            && token_store_kind(t, i + 2) == token_type_open_paren) {
+            size_t j = i + 3;
+            while (j < n && token_store_kind(t, j) != token_type_open_braces) j++;
+            size_t open = 0;
+            for (; j < n; j++) {
+                TokenType kj = token_store_kind(t, j);
+                if (kj == token_type_open_braces) open++;
+                else if (kj == token_type_close_braces && --open == 0) break;
+            }
+            size_t end = j < n ? j + 1 : n;
+            push_segment(segs, gap, i, 0);
+            push_segment(segs, i, end, 1);
+            gap = end;
+            i = end - 1;
+            continue;
+        }
+        if (k == token_type_open_braces) depth++;
+        else if (k == token_type_close_braces && depth > 0) depth--;
+    }
+    push_segment(segs, gap, n, 0);
+}
+
+static void* parse_worker(void* arg) {
+    ParseWorker* w = (ParseWorker*)arg;
+    Parser_data* p = init_parser(*w->tokens, w->lines);
+    if (!p) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    p->m_ast = &w->ast;
+    // segments already end at function boundaries, every body is parsed here
+    // so they spread over the workers instead of waiting for the join
+    p->m_lazy = false;
+
+    while (1) {
+        size_t i = atomic_fetch_add(w->next, 1);
+        if (i >= kv_size(*w->segs)) break;
+        ParseSegment* seg = &kv_A(*w->segs, i);
+        p->m_index = (int)seg->start;
+        p->m_end = seg->end;
+        seg->stmts = parse_stmt_list(p);
+        seg->worker = w->id;
+    }
+
+    kv_destroy(p->m_scratch);
+    free(p);
+    return NULL;
+}
+
+OptionalNodeProg parse_prog_parallel(const TokenStore* tokens, SourceLines* lines, int n_threads) {
+    ParseSegments segs;
+    kv_init(segs);
+    find_segments(tokens, &segs);
+
+    size_t funcs = 0;
+    for (size_t i = 0; i < kv_size(segs); i++) funcs += kv_A(segs, i).is_func;
+
+    // not worth a thread for less than this many tokens, or without functions to share
+    size_t max_workers = tokens->n / PARALLEL_PARSE_MIN_TOKENS;
+    if (max_workers > funcs) max_workers = funcs;
+    if (n_threads > (int)max_workers) n_threads = (int)max_workers;
+    if (n_threads < 2) {
+        kv_destroy(segs);
+        Parser_data* p = init_parser(*tokens, lines);
+        if (!p) { fprintf(stderr, "Out of memory\n"); exit(1); }
+        OptionalNodeProg result = parse_prog(p);
+        kv_destroy(p->m_scratch);
+        free(p);
+        return result;
+    }
+
+    ParseWorker* workers = (ParseWorker*)calloc(n_threads, sizeof(ParseWorker));
+    pthread_t* threads = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+    if (!workers || !threads) { fprintf(stderr, "Out of memory\n"); exit(1); }
+
+    atomic_size_t next = 0;
+    for (int i = 0; i < n_threads; i++) {
+        workers[i].tokens = tokens;
+        workers[i].lines = lines;
+        workers[i].segs = &segs;
+        workers[i].next = &next;
+        workers[i].id = i;
+        ast_init(&workers[i].ast);
+    }
+    for (int i = 1; i < n_threads; i++) {
+        if (pthread_create(&threads[i], NULL, parse_worker, &workers[i]) != 0) {
+            // one thread less, the others pick up its share
+            threads[i] = 0;
+        }
+    }
+    parse_worker(&workers[0]);
+    for (int i = 1; i < n_threads; i++) {
+        if (threads[i]) pthread_join(threads[i], NULL);
+    }
+
+    OptionalNodeProg result = {0};
+    ast_init(&result.value);
+    AstOffsets* offs = (AstOffsets*)calloc(n_threads, sizeof(AstOffsets));
+    if (!offs) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    for (int i = 0; i < n_threads; i++) {
+        offs[i] = ast_append(&result.value, &workers[i].ast);
+        ast_free(&workers[i].ast);
+    }
+
+    // top level in source order
+    NodeProg* ast = &result.value;
+    ast->stmt.start = (uint32_t)kv_size(ast->lists);
+    for (size_t i = 0; i < kv_size(segs); i++) {
+        const ParseSegment* seg = &kv_A(segs, i);
+        const AstOffsets* off = &offs[seg->worker];
+        for (uint32_t k = 0; k < seg->stmts.count; k++) {
+            uint32_t local = kv_A(ast->lists, off->list + seg->stmts.start + k);
+            kv_push(uint32_t, ast->lists, local + off->stmt);
+        }
     }
+    ast->stmt.count = (uint32_t)kv_size(ast->lists) - ast->stmt.start;
 
+    free(offs);
+    free(workers);
+    free(threads);
+    kv_destroy(segs);
     result.has_value = 1;
     return result;
 }
@@ -2,60 +2,66 @@
 
 #include "../libs/kvec.h"
 #include "../tokenizer/tokenizer.h"
+#include <stdbool.h>
 
 struct Parser_data;
 typedef struct Parser_data Parser_data;
 typedef struct NodeExpr NodeExpr;
 typedef struct NodeStmt NodeStmt;
-typedef kvec_t(NodeStmt) NodeStmtArray;
-typedef struct {
-    Token pair[2]; // 0 is type 1 is name
-} Arg;
-typedef kvec_t(Arg) Args;
+typedef struct NodeProg NodeProg;
+
+// ---- Flat AST ----
+// statements, expressions and tokens live in typed arrays inside NodeProg and
+// refer to each other by 32-bit index. variable length children (bodies, call
+// arguments, parameters) are ranges of the shared id table NodeProg.lists.
+typedef uint32_t StmtId;
+typedef uint32_t ExprId;
+typedef uint32_t TokId;
+
+#define AST_NONE UINT32_MAX
+
+typedef struct AstList {
+    uint32_t start; // first entry in NodeProg.lists
+    uint32_t count;
+} AstList;
+
+// initial ring size when streaming, parser_peek(p, 2) needs three tokens in flight.
+// must be a power of two, the ring doubles if an expression scan looks further ahead
+#define PARSER_LOOKAHEAD 4
 
 struct Parser_data {
-    int m_index;
-    TokenArray m_tokens;
+    int m_index;        // tokens consumed so far
+    TokenStore m_tokens;
+    size_t m_end;       // tokens from here on read as token_empty, a sub parser's range ends here
+
+    // streaming mode: tokens are pulled from m_lexer on demand instead of m_tokens
+    Token_data* m_lexer;
+    Token* m_ring;
+    size_t m_ring_cap;
+    size_t m_ring_head;
+    size_t m_ring_count;
+
+    SourceLines* m_lines; // for diagnostics, shared with sub parsers
+
+    NodeProg* m_ast;      // program being built
+    // skip top-level function bodies until something reachable calls them.
+    // off unless asked for: errors in a body nothing calls go unreported
+    bool m_lazy;
+    kvec_t(uint32_t) m_scratch; // ids of the lists still being parsed, see list_begin()
 };
 
 typedef struct NodeExprIntLit {
-    Token int_lit;
+    TokId int_lit;
 } NodeExprIntLit;
 
 typedef struct NodeExprChar {
-    Token char_;
+    TokId char_;
 } NodeExprChar;
 
 typedef struct NodeExprIdent {
-    Token ident;
+    TokId ident;
 } NodeExprIdent;
 
-typedef struct BinExprAdd BinExprAdd;
-typedef struct BinExprMulti BinExprMulti;
-typedef struct BinExprMinus BinExprMinus;
-typedef struct BinExprDivide BinExprDivide;
-typedef struct BinExprBinOp BinExprBinOp;
-typedef struct BinExpr BinExpr;
-
-typedef enum {
-    BIN_EXPR,
-    NODE_EXPR,
-} BindExprRecKind;
-
-typedef struct BindExprRec {
-    BindExprRecKind type;
-    union {
-        BinExpr* bin_expr;
-        NodeExpr* node_expr;
-    } as;
-} BindExprRec;
-
-struct BinExprAdd { BindExprRec lhs; BindExprRec rhs; };
-struct BinExprMinus { BindExprRec lhs; BindExprRec rhs; };
-struct BinExprMulti { BindExprRec lhs; BindExprRec rhs; };
-struct BinExprDivide { BindExprRec lhs; BindExprRec rhs; };
-struct BinExprBinOp { BindExprRec lhs; BindExprRec rhs; };
-
 typedef enum {
     BIN_EXPR_ADD,
     BIN_EXPR_MULTI,
@@ -71,16 +77,12 @@ typedef enum {
     BIN_EXPR_OR,
 } BinExprKind;
 
-struct BinExpr {
+// every binary operator, both operands are nodes of NodeProg.exprs
+typedef struct BinExpr {
     BinExprKind kind;
-    union {
-        BinExprAdd add;
-        BinExprMulti multi;
-        BinExprMinus minus;
-        BinExprDivide divide;
-        BinExprBinOp binop;
-    } as;
-};
+    ExprId lhs;
+    ExprId rhs;
+} BinExpr;
 
 typedef enum {
     NODE_EXPR_INT_LIT,
@@ -92,8 +94,8 @@ typedef enum {
 } NodeExprKind;
 
 typedef struct NodeExprFunc {
-    Token name;
-    TokenArray args;
+    TokId name;
+    AstList args; // TokIds
 } NodeExprFunc;
 
 struct NodeExpr {
@@ -103,39 +105,39 @@ struct NodeExpr {
         NodeExprIdent ident;
         NodeExprChar char_;
         NodeExprFunc func;
-        BinExpr* bin;
+        BinExpr bin;
     } as;
 };
 
 typedef struct NodeStmtExit {
-    NodeExpr expr;
+    ExprId expr;
 } NodeStmtExit;
 
 
 typedef struct NodeStmtChar {
-    Token ident;
-    NodeExpr expr;
+    TokId ident;
+    ExprId expr;
 } NodeStmtChar;
 
 typedef struct NodeStmtInt {
-    Token ident;
-    NodeExpr expr;
+    TokId ident;
+    ExprId expr;
 } NodeStmtInt;
 
 typedef struct NodeStmtShort {
-    Token ident;
-    NodeExpr expr;
+    TokId ident;
+    ExprId expr;
 } NodeStmtShort;
 
 typedef struct NodeStmtLong {
-    Token ident;
-    NodeExpr expr;
+    TokId ident;
+    ExprId expr;
 } NodeStmtLong;
 
 
 typedef struct NodeStmtVchange {
-    Token ident;
-    NodeExpr expr;
+    TokId ident;
+    ExprId expr;
 } NodeStmtVchange;
 
 typedef enum {
@@ -155,52 +157,49 @@ typedef enum {
 } NodeStmtKind;
 
 typedef struct NodeStmtIf {
-    NodeExpr cond;
-    NodeStmtArray body;
+    ExprId cond;
+    AstList body; // StmtIds
 } NodeStmtIf;
 
 typedef struct NodeStmtElse {
-    NodeStmtArray body;
+    AstList body;
 } NodeStmtElse;
 
 typedef struct NodeStmtWhile {
-    NodeExpr cond;
-    NodeStmtArray body;
+    ExprId cond;
+    AstList body;
 } NodeStmtWhile;
 
 typedef struct NodeStmtFor {
-    NodeStmt* cond1; // local for var init
-    NodeExpr cond2; // stop logic operation
-    NodeStmt* cond3; // expr that goes every iteration
-    NodeStmtArray body;
+    StmtId cond1; // local for var init
+    ExprId cond2; // stop logic operation
+    StmtId cond3; // expr that goes every iteration
+    AstList body;
 } NodeStmtFor;
 
-
-typedef struct NodeStmtReturnType {
-    NodeExpr ReturnType;
-} NodeStmtReturnType;
-
 typedef struct NodeStmtReturn {
-    NodeExpr res;
+    ExprId res; // AST_NONE for a bare return
 } NodeStmtReturn;
 
 
 typedef struct NodeStmtFunction {
-    Token name;
-    NodeStmtReturnType return_type;
-    Token ExpectedReturnType;
-    NodeStmtArray body;
-    Args types;
+    TokId name;
+    TokId ExpectedReturnType;
+    AstList body;
+    AstList types; // two TokIds per parameter: type, name
+    // lazily parsed body: index and byte offset of its first token in the
+    // source. body_at is AST_NONE once the body is parsed
+    uint32_t body_at;
+    uint32_t body_offset;
 } NodeStmtFunction;
 
 
 typedef struct NodeStmtFunCall {
-    Token name;
-    TokenArray args;
-
+    TokId name;
+    AstList args; // TokIds
 } NodeStmtFunCall;
 
-typedef struct NodeStmt {
+struct NodeStmt {
     NodeStmtKind kind;
     union {
         NodeStmtChar char_;
@@ -217,26 +216,41 @@ typedef struct NodeStmt {
         NodeStmtFunCall func_call;
         NodeStmtVchange vchange;
     } as;
-} NodeStmt;
-
-typedef struct NodeProg {
-    NodeStmtArray stmt;
-} NodeProg;
-
-typedef struct OptionalNodeExpr {
-    int has_value;
-    NodeExpr value;
-} OptionalNodeExpr;
-
-typedef struct OptionalBinExpr {
-    int has_value;
-    BinExpr value;
-} OptionalBinExpr;
+};
 
-typedef struct OptionalNodeStmt {
-    int has_value;
-    NodeStmt value;
-} OptionalNodeStmt;
+// postfix form of an expression: operands in evaluation order, each
+// operator right after its two operands
+typedef enum {
+    RPN_OPERAND,  // leaf or call, its value goes on top
+    RPN_BRANCH,   // left side of && / || is on top, the right side may be skipped
+    RPN_OPERATOR, // replaces the two values on top with the result
+} RpnKind;
+
+typedef struct RpnOp {
+    uint8_t kind; // RpnKind
+    uint8_t op;   // BinExprKind of RPN_BRANCH / RPN_OPERATOR
+    ExprId expr;  // the leaf or BIN node, AST_NONE for RPN_BRANCH
+} RpnOp;
+
+// code of one expression given to parse_expr()
+typedef struct ExprCode {
+    ExprId root;
+    AstList ops; // range of NodeProg.rpn
+} ExprCode;
+
+struct NodeProg {
+    kvec_t(NodeStmt) stmts;
+    kvec_t(NodeExpr) exprs;
+    kvec_t(Token) toks;
+    kvec_t(uint32_t) lists;
+    kvec_t(RpnOp) rpn;
+    kvec_t(ExprCode) codes; // sorted by root
+    AstList stmt; // top level statements
+    // cache file the tables point into, see parser/cache. NULL while they are
+    // on the heap, a mapped program is read only
+    void* map;
+    size_t map_len;
+};
 
 typedef struct OptionalNodeProg {
     int has_value;
@@ -248,24 +262,70 @@ typedef struct OptionalToken {
     Token value;
 } OptionalToken;
 
-typedef struct NodeIf {
-    NodeExpr* lhs;
-    Token operator;
-    NodeExpr* rhs;
-} NodeIf;
-
-Parser_data* init_parser(TokenArray src);
+// ---- AST access ----
+// pointers returned here are only stable once parsing is done
+static inline NodeStmt* ast_stmt(const NodeProg* a, StmtId id) {
+    return id == AST_NONE ? NULL : &a->stmts.a[id];
+}
+
+// inverse of ast_stmt(), stmt has to live in a
+static inline StmtId ast_stmt_id(const NodeProg* a, const NodeStmt* stmt) {
+    return (StmtId)(stmt - a->stmts.a);
+}
+
+static inline NodeExpr* ast_expr(const NodeProg* a, ExprId id) {
+    return id == AST_NONE ? NULL : &a->exprs.a[id];
+}
+
+static inline Token ast_tok(const NodeProg* a, TokId id) {
+    return a->toks.a[id];
+}
+
+// i-th id of a list
+static inline uint32_t ast_list_at(const NodeProg* a, AstList l, uint32_t i) {
+    return a->lists.a[l.start + i];
+}
+
+// function whose body was never parsed, nothing reachable calls it
+static inline bool ast_body_pending(const NodeStmt* stmt) {
+    return stmt->kind == NODE_STMT_FUNC && stmt->as.func.body_at != AST_NONE;
+}
+
+void ast_init(NodeProg* a);
+void ast_free(NodeProg* a);
+StmtId ast_push_stmt(NodeProg* a, NodeStmt stmt);
+ExprId ast_push_expr(NodeProg* a, NodeExpr expr);
+TokId ast_push_tok(NodeProg* a, Token tok);
+void ast_push_rpn(NodeProg* a, RpnKind kind, BinExprKind op, ExprId expr);
+AstList ast_expr_code(const NodeProg* a, ExprId root); // postfix ops of a parse_expr() result
+
+Parser_data* init_parser(TokenStore src, SourceLines* lines);
+Parser_data* init_parser_stream(Token_data* lexer, SourceLines* lines);
+
+// "line:col: error: ..." at the current token, then exit
+__attribute__((noreturn, format(printf, 2, 3)))
+void parser_error(Parser_data* p, const char* fmt, ...);
+
+// child lists under construction: list_begin(), list_add() per child, list_end()
+size_t list_begin(Parser_data* p);
+void list_add(Parser_data* p, uint32_t id);
+AstList list_end(Parser_data* p, size_t mark);
 
 OptionalToken parser_peek(Parser_data* p, int offset);
+TokenType parser_peek_kind(Parser_data* p, int offset);
 Token parser_consume(Parser_data* p);
 
-void print_bin_expr(BinExpr* node, int depth);
+void print_bin_expr(const NodeProg* ast, const BinExpr* node, int depth);
 
-OptionalBinExpr parse_bin_stmt(Parser_data* p);
-OptionalNodeExpr parse_expr(Parser_data* p);
-OptionalNodeStmt parse_stmt(Parser_data* p);
+ExprId parse_expr(Parser_data* p); // AST_NONE if no expression starts here
+StmtId parse_stmt(Parser_data* p); // AST_NONE if no statement starts here
 OptionalNodeProg parse_prog(Parser_data* p);
 
-OptionalNodeExpr parse_expr_to_terminator(Parser_data* p);
+// smallest share of tokens worth giving its own parser thread
+#define PARALLEL_PARSE_MIN_TOKENS (64 * 1024)
+
+// parse on up to n_threads threads, top-level functions are parsed concurrently.
+// same program as parse_prog() on init_parser(*tokens), every body is parsed
+OptionalNodeProg parse_prog_parallel(const TokenStore* tokens, SourceLines* lines, int n_threads);
+
 
-BindExprRec parse_bin_stmt_rec(Parser_data* p, BinExpr* top, int ptr, const int ptr_max);
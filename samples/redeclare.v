@@ -0,0 +1,5 @@
+int c = 7;
+int b = 1;
+long b = 5;
+int d = c;
+exit(d);
@@ -0,0 +1,102 @@
+#include "intern.h"
+#include "../../libs/kvec.h"
+#include "../../libs/khashl.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---------- String interner ----------
+// every distinct identifier / literal is stored once, tokens only keep the id.
+// the table lives for the whole compile so ids stay valid in every phase.
+// it is split into shards with their own lock so parallel lexer workers rarely
+// wait on each other; a Symbol encodes (index in shard, shard).
+
+#define INTERN_SHARD_BITS 4
+#define INTERN_SHARDS (1u << INTERN_SHARD_BITS)
+
+typedef struct InternKey {
+    const char* s;
+    uint32_t len;
+} InternKey;
+
+static inline khint_t intern_hash(InternKey k) {
+    return kh_hash_bytes((int)k.len, (const unsigned char*)k.s);
+}
+
+static inline int intern_eq(InternKey a, InternKey b) {
+    return a.len == b.len && memcmp(a.s, b.s, a.len) == 0;
+}
+
+KHASHL_MAP_INIT(KH_LOCAL, intern_map_t, intern_map, InternKey, Symbol, intern_hash, intern_eq)
+
+typedef struct InternShard {
+    pthread_mutex_t lock;
+    intern_map_t* map;
+    kvec_t(InternKey) names; // slot 0 is never used, so no Symbol is SYMBOL_NONE
+} InternShard;
+
+static InternShard g_shards[INTERN_SHARDS];
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+
+static void intern_init(void) {
+    InternKey none = { NULL, 0 };
+    for (unsigned i = 0; i < INTERN_SHARDS; i++) {
+        pthread_mutex_init(&g_shards[i].lock, NULL);
+        g_shards[i].map = intern_map_init();
+        kv_init(g_shards[i].names);
+        kv_push(InternKey, g_shards[i].names, none);
+    }
+}
+
+Symbol intern(const char* s, size_t len) {
+    pthread_once(&g_once, intern_init);
+
+    InternKey key = { s, (uint32_t)len };
+    unsigned shard_id = intern_hash(key) & (INTERN_SHARDS - 1);
+    InternShard* shard = &g_shards[shard_id];
+
+    pthread_mutex_lock(&shard->lock);
+    int absent;
+    khint_t it = intern_map_put(shard->map, key, &absent);
+    if (!absent) {
+        Symbol sym = kh_val(shard->map, it);
+        pthread_mutex_unlock(&shard->lock);
+        return sym;
+    }
+
+    // first time we see it: the key still points into the source, swap in our own copy
+    char* copy = (char*)malloc(len + 1);
+    if (!copy) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    key.s = copy;
+
+    Symbol sym = (Symbol)(kv_size(shard->names) << INTERN_SHARD_BITS) | shard_id;
+    kv_push(InternKey, shard->names, key);
+    kh_key(shard->map, it) = key;
+    kh_val(shard->map, it) = sym;
+    pthread_mutex_unlock(&shard->lock);
+    return sym;
+}
+
+static InternKey intern_lookup(Symbol sym) {
+    InternKey none = { NULL, 0 };
+    if (sym == SYMBOL_NONE) return none;
+    pthread_once(&g_once, intern_init);
+
+    InternShard* shard = &g_shards[sym & (INTERN_SHARDS - 1)];
+    size_t idx = sym >> INTERN_SHARD_BITS;
+    pthread_mutex_lock(&shard->lock);
+    InternKey key = idx < kv_size(shard->names) ? kv_A(shard->names, idx) : none;
+    pthread_mutex_unlock(&shard->lock);
+    return key;
+}
+
+const char* intern_str(Symbol sym) {
+    return intern_lookup(sym).s;
+}
+
+size_t intern_len(Symbol sym) {
+    return intern_lookup(sym).len;
+}
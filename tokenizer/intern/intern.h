@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// id of an interned string, 0 means "no value"
+typedef uint32_t Symbol;
+
+#define SYMBOL_NONE 0
+
+// returns the id for s[0..len), copying the bytes only the first time they are seen
+Symbol intern(const char* s, size_t len);
+
+// null terminated text of a symbol, NULL for SYMBOL_NONE
+const char* intern_str(Symbol sym);
+size_t intern_len(Symbol sym);
@@ -0,0 +1,40 @@
+#include "lines.h"
+#include <string.h>
+
+void source_lines_init(SourceLines* l, const char* src, size_t len) {
+    l->src = src;
+    l->len = len;
+    kv_init(l->starts);
+}
+
+void source_lines_free(SourceLines* l) {
+    kv_destroy(l->starts);
+    kv_init(l->starts);
+}
+
+// one memchr pass over the whole source
+static void build_lines(SourceLines* l) {
+    kv_push(uint32_t, l->starts, 0);
+    const char* p = l->src;
+    const char* end = l->src + l->len;
+    while (p < end && (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        p++;
+        kv_push(uint32_t, l->starts, (uint32_t)(p - l->src));
+    }
+}
+
+SourceLoc source_loc(SourceLines* l, uint32_t offset) {
+    if (kv_size(l->starts) == 0) build_lines(l);
+
+    // last line start <= offset
+    size_t lo = 0, hi = kv_size(l->starts);
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (kv_A(l->starts, mid) <= offset) lo = mid;
+        else hi = mid;
+    }
+    SourceLoc loc;
+    loc.line = (uint32_t)lo + 1;
+    loc.col = offset - kv_A(l->starts, lo) + 1;
+    return loc;
+}
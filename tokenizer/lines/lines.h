@@ -0,0 +1,25 @@
+#pragma once
+
+#include "../../libs/kvec.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Line / column lookup for diagnostics.
+// tokens only carry a byte offset; the table of line starts is built on the
+// first lookup, so a compile that never reports anything never scans for newlines.
+
+typedef struct SourceLoc {
+    uint32_t line; // 1 based
+    uint32_t col;  // 1 based, in bytes
+} SourceLoc;
+
+typedef struct SourceLines {
+    const char* src;
+    size_t len;
+    kvec_t(uint32_t) starts; // offset of every line start, empty until first lookup
+} SourceLines;
+
+void source_lines_init(SourceLines* l, const char* src, size_t len);
+void source_lines_free(SourceLines* l);
+
+SourceLoc source_loc(SourceLines* l, uint32_t offset);
@@ -0,0 +1,151 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+typedef size_t (*scan_fn)(const char* s, size_t i, size_t n);
+
+// ---------- Scalar ----------
+// same classes as isalnum/isdigit/isspace in the C locale
+
+static inline int is_ident_byte(unsigned char c) {
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+}
+
+static inline int is_digit_byte(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline int is_space_byte(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static size_t scan_ident_scalar(const char* s, size_t i, size_t n) {
+    while (i < n && is_ident_byte((unsigned char)s[i])) i++;
+    return i;
+}
+
+static size_t scan_digits_scalar(const char* s, size_t i, size_t n) {
+    while (i < n && is_digit_byte((unsigned char)s[i])) i++;
+    return i;
+}
+
+static size_t scan_space_scalar(const char* s, size_t i, size_t n) {
+    while (i < n && is_space_byte((unsigned char)s[i])) i++;
+    return i;
+}
+
+// ---------- SSE2 (16 bytes per step) ----------
+// bytes >= 0x80 are negative for the signed compares, so they never match a class
+
+#ifdef __SSE2__
+static inline __m128i in_range16(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+static inline __m128i ident_mask16(__m128i v) {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(in_range16(lower, 'a', 'z'), in_range16(v, '0', '9'));
+}
+
+static inline __m128i digit_mask16(__m128i v) {
+    return in_range16(v, '0', '9');
+}
+
+static inline __m128i space_mask16(__m128i v) {
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range16(v, '\t', '\r'));
+}
+
+#define SCAN_SSE2(name, mask_fn, tail_fn)                                       \
+    static size_t name(const char* s, size_t i, size_t n) {                     \
+        while (i + 16 <= n) {                                                   \
+            __m128i v = _mm_loadu_si128((const __m128i*)(s + i));               \
+            unsigned mask = (unsigned)_mm_movemask_epi8(mask_fn(v));            \
+            if (mask != 0xFFFFu) return i + (size_t)__builtin_ctz(~mask);       \
+            i += 16;                                                            \
+        }                                                                       \
+        return tail_fn(s, i, n);                                                \
+    }
+
+SCAN_SSE2(scan_ident_sse2, ident_mask16, scan_ident_scalar)
+SCAN_SSE2(scan_digits_sse2, digit_mask16, scan_digits_scalar)
+SCAN_SSE2(scan_space_sse2, space_mask16, scan_space_scalar)
+#endif
+
+// ---------- AVX2 (32 bytes per step) ----------
+// compiled with a target attribute so the rest of the build stays baseline x86-64
+
+#if defined(SCAN_X86) && defined(__GNUC__)
+#define SCAN_AVX2_FN __attribute__((target("avx2")))
+
+SCAN_AVX2_FN static inline __m256i in_range32(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+SCAN_AVX2_FN static inline __m256i ident_mask32(__m256i v) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(in_range32(lower, 'a', 'z'), in_range32(v, '0', '9'));
+}
+
+SCAN_AVX2_FN static inline __m256i digit_mask32(__m256i v) {
+    return in_range32(v, '0', '9');
+}
+
+SCAN_AVX2_FN static inline __m256i space_mask32(__m256i v) {
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range32(v, '\t', '\r'));
+}
+
+#define SCAN_AVX2(name, mask_fn, tail_fn)                                       \
+    SCAN_AVX2_FN static size_t name(const char* s, size_t i, size_t n) {        \
+        while (i + 32 <= n) {                                                   \
+            __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));            \
+            unsigned mask = (unsigned)_mm256_movemask_epi8(mask_fn(v));         \
+            if (mask != 0xFFFFFFFFu) return i + (size_t)__builtin_ctz(~mask);   \
+            i += 32;                                                            \
+        }                                                                       \
+        return tail_fn(s, i, n);                                                \
+    }
+
+SCAN_AVX2(scan_ident_avx2, ident_mask32, scan_ident_scalar)
+SCAN_AVX2(scan_digits_avx2, digit_mask32, scan_digits_scalar)
+SCAN_AVX2(scan_space_avx2, space_mask32, scan_space_scalar)
+#define SCAN_HAVE_AVX2 1
+#endif
+
+// ---------- Dispatch ----------
+
+static scan_fn scan_ident_impl = scan_ident_scalar;
+static scan_fn scan_digits_impl = scan_digits_scalar;
+static scan_fn scan_space_impl = scan_space_scalar;
+
+void scan_init(void) {
+#ifdef __SSE2__
+    scan_ident_impl = scan_ident_sse2;
+    scan_digits_impl = scan_digits_sse2;
+    scan_space_impl = scan_space_sse2;
+#endif
+#ifdef SCAN_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan_ident_impl = scan_ident_avx2;
+        scan_digits_impl = scan_digits_avx2;
+        scan_space_impl = scan_space_avx2;
+    }
+#endif
+}
+
+size_t scan_ident(const char* s, size_t i, size_t n) {
+    return scan_ident_impl(s, i, n);
+}
+
+size_t scan_digits(const char* s, size_t i, size_t n) {
+    return scan_digits_impl(s, i, n);
+}
+
+size_t scan_space(const char* s, size_t i, size_t n) {
+    return scan_space_impl(s, i, n);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+
+// Character class scanners used by the lexer.
+// each one starts at s[i] and returns the index of the first byte in [i, n)
+// that is NOT in the class (n if the run reaches the end).
+// picks an AVX2 / SSE2 / scalar version once at startup.
+
+void scan_init(void);
+
+size_t scan_ident(const char* s, size_t i, size_t n);  // [A-Za-z0-9]
+size_t scan_digits(const char* s, size_t i, size_t n); // [0-9]
+size_t scan_space(const char* s, size_t i, size_t n);  // ' ' \t \n \v \f \r
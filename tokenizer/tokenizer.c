@@ -1,169 +1,489 @@
 #include "tokenizer.h"
+#include "scan/scan.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <stdarg.h>
 
 #define INVALID_CHAR '\xFF'
 
 // ---------- Token_data helpers ----------
 
-Token_data* tokenizer_create(const char* src) {
+Token_data* tokenizer_create(StringView src) {
     Token_data* t = (Token_data*)malloc(sizeof(Token_data));
     t->m_index = 0;
-    t->m_src = strdup(src);
-    t->m_buf[0] = '\0';
-    t->m_len = 0;
+    // no copy, the lexer reads the mapped file in place
+    t->m_src = src.data;
+    t->m_src_len = src.size;
+    t->m_start = 0;
+    scan_init();
     return t;
 }
 
 static inline char peek(Token_data* t, int offset) {
     size_t pos = t->m_index + offset;
-    if (!t->m_src || pos >= strlen(t->m_src)) return INVALID_CHAR;
+    if (!t->m_src || pos >= t->m_src_len) return INVALID_CHAR;
     return t->m_src[pos];
 }
 
 static inline char consume(Token_data* t) {
-    if (!t->m_src || t->m_index >= strlen(t->m_src)) return INVALID_CHAR;
+    if (!t->m_src || t->m_index >= t->m_src_len) return INVALID_CHAR;
     return t->m_src[t->m_index++];
 }
 
-static inline void push_back(Token_data* t, char c) {
-    if (t->m_len < BUF_SIZE - 1) {
-        t->m_buf[t->m_len++] = c;
-        t->m_buf[t->m_len] = '\0';  // null terminate
+// ---------- Keywords ----------
+// perfect hash over the keyword set: (first * 6 + last + len) & 15 puts every
+// keyword in its own slot, so a lookup is one hash, one length check and one memcmp.
+// if you add a keyword, search new multipliers so the slots stay collision free.
+#define KEYWORD_HASH(s, len) (((unsigned char)(s)[0] * 6u + (unsigned char)(s)[(len) - 1] + (unsigned)(len)) & 15u)
+
+typedef struct {
+    const char* text;
+    size_t len;
+    TokenType type;
+} Keyword;
+
+static const Keyword keywords[16] = {
+    [0]  = { "return", 6, token_type_return },
+    [3]  = { "long",   4, token_type_long },
+    [4]  = { "while",  5, token_type_while },
+    [6]  = { "exit",   4, token_type_exit_kw },
+    [7]  = { "else",   4, token_type_else },
+    [8]  = { "char",   4, token_type_char_t },
+    [9]  = { "for",    3, token_type_for },
+    [11] = { "short",  5, token_type_short },
+    [12] = { "void",   4, token_type_void },
+    [13] = { "int",    3, token_type_int },
+    [14] = { "if",     2, token_type_if },
+};
+
+// token_type_ident when s[0..len) is not a keyword
+static inline TokenType keyword_lookup(const char* s, size_t len) {
+    const Keyword* kw = &keywords[KEYWORD_HASH(s, len)];
+    if (kw->len == len && memcmp(kw->text, s, len) == 0) return kw->type;
+    return token_type_ident;
+}
+
+// ---------- Token store ----------
+
+void token_store_init(TokenStore* s) {
+    s->n = s->m = 0;
+    s->kind = NULL;
+    s->offset = NULL;
+    s->len = NULL;
+    s->sym = NULL;
+    kv_init(s->lits);
+}
+
+// room for at least n tokens
+static void token_store_reserve(TokenStore* s, size_t n) {
+    if (n <= s->m) return;
+    size_t m = s->m ? s->m : 64;
+    while (m < n) m <<= 1;
+    s->m = m;
+    s->kind = (uint8_t*)realloc(s->kind, s->m * sizeof(uint8_t));
+    s->offset = (uint32_t*)realloc(s->offset, s->m * sizeof(uint32_t));
+    s->len = (uint32_t*)realloc(s->len, s->m * sizeof(uint32_t));
+    s->sym = (Symbol*)realloc(s->sym, s->m * sizeof(Symbol));
+    if (!s->kind || !s->offset || !s->len || !s->sym) { fprintf(stderr, "Out of memory\n"); exit(1); }
+}
+
+void token_store_push(TokenStore* s, Token tok) {
+    if (s->n == s->m) token_store_reserve(s, s->n + 1);
+    s->kind[s->n] = (uint8_t)tok.type;
+    s->offset[s->n] = tok.offset;
+    s->len[s->n] = tok.len;
+    s->sym[s->n] = tok.sym;
+    if (is_literal_kind(tok.type)) {
+        TokenLit lit = { (uint32_t)s->n, tok.lit };
+        kv_push(TokenLit, s->lits, lit);
+    }
+    s->n++;
+}
+
+// first entry of the literal side table whose token is >= i
+static size_t token_store_lit_lower(const TokenStore* s, size_t i) {
+    size_t lo = 0, hi = kv_size(s->lits);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (kv_A(s->lits, mid).token < i) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// value of literal token i, binary search over the literal side table
+int64_t token_store_lit(const TokenStore* s, size_t i) {
+    size_t lo = token_store_lit_lower(s, i);
+    if (lo < kv_size(s->lits) && kv_A(s->lits, lo).token == i) return kv_A(s->lits, lo).value;
+    return 0;
+}
+
+// appends src tokens [from, to) to dst with their offsets moved by shift
+static void token_store_append(TokenStore* dst, const TokenStore* src, size_t from, size_t to, int64_t shift) {
+    size_t count = to - from;
+    if (count == 0) return;
+    token_store_reserve(dst, dst->n + count);
+    memcpy(dst->kind + dst->n, src->kind + from, count * sizeof(uint8_t));
+    memcpy(dst->len + dst->n, src->len + from, count * sizeof(uint32_t));
+    memcpy(dst->sym + dst->n, src->sym + from, count * sizeof(Symbol));
+    if (shift == 0) {
+        memcpy(dst->offset + dst->n, src->offset + from, count * sizeof(uint32_t));
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            dst->offset[dst->n + i] = (uint32_t)((int64_t)src->offset[from + i] + shift);
+        }
+    }
+    for (size_t j = token_store_lit_lower(src, from); j < kv_size(src->lits) && kv_A(src->lits, j).token < to; j++) {
+        TokenLit lit = kv_A(src->lits, j);
+        lit.token = (uint32_t)(lit.token - from + dst->n);
+        kv_push(TokenLit, dst->lits, lit);
+    }
+    dst->n += count;
+}
+
+void token_store_free(TokenStore* s) {
+    free(s->kind);
+    free(s->offset);
+    free(s->len);
+    free(s->sym);
+    kv_destroy(s->lits);
+    token_store_init(s);
+}
+
+// ---------- Errors ----------
+
+// reports "line:col: error: ..." for the byte at offset and stops.
+// the line table is only built here, lexing itself never tracks lines
+static __attribute__((noreturn)) void lex_error(Token_data* t, size_t offset, const char* fmt, ...) {
+    SourceLines lines;
+    source_lines_init(&lines, t->m_src, t->m_src_len);
+    SourceLoc loc = source_loc(&lines, (uint32_t)offset);
+    source_lines_free(&lines);
+
+    fprintf(stderr, "%u:%u: error: ", loc.line, loc.col);
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+// ---------- Literals ----------
+
+static int digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 99;
+}
+
+// decimal, 0x hex or 0b binary, errors out if it does not fit an int64
+static int64_t decode_int_lit(Token_data* t, const char* s, size_t len) {
+    int base = 10;
+    size_t i = 0;
+    if (len > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) { base = 16; i = 2; }
+    else if (len > 2 && s[0] == '0' && (s[1] == 'b' || s[1] == 'B')) { base = 2; i = 2; }
+
+    uint64_t value = 0;
+    for (; i < len; i++) {
+        int d = digit_value(s[i]);
+        if (d >= base) {
+            lex_error(t, t->m_start + i, "invalid digit '%c' in integer literal '%.*s'", s[i], (int)len, s);
+        }
+        if (value > ((uint64_t)INT64_MAX - (uint64_t)d) / (uint64_t)base) {
+            lex_error(t, t->m_start, "integer literal '%.*s' is too large", (int)len, s);
+        }
+        value = value * base + d;
     }
+    return (int64_t)value;
 }
 
 // ---------- Push token functions ----------
 
-void push_token_value(Token_data* t, TokenArray* tokens, TokenType type) {
-    if (t->m_len == 0) return;
+const char* token_value(Token tok) {
+    return intern_str(tok.sym);
+}
+
+// fill *out from the span [m_start, m_index), returns 0 when there is nothing to emit
+int push_token_value(Token_data* t, Token* out, TokenType type) {
+    size_t len = t->m_index - t->m_start;
+    if (len == 0) return 0;
 
     Token tok;
     tok.type = type;
-    tok.value = strndup(t->m_buf, t->m_len);  // allocate string
-    kv_push(Token, *tokens, tok);
-
-    t->m_len = 0;
-    t->m_buf[0] = '\0';
+    tok.offset = (uint32_t)t->m_start;
+    tok.len = (uint32_t)len;
+    tok.sym = intern(t->m_src + t->m_start, len);
+    tok.lit = 0;
+    if (type == token_type_int_lit) tok.lit = decode_int_lit(t, t->m_src + t->m_start, len);
+    else if (type == token_type_char_v) tok.lit = (unsigned char)t->m_src[t->m_start];
+    *out = tok;
+    return 1;
 }
 
-void push_token(Token_data* t, TokenArray* tokens, TokenType type) {
+int push_token(Token_data* t, Token* out, TokenType type) {
     Token tok;
     tok.type = type;
-    tok.value = NULL;
-    kv_push(Token, *tokens, tok);
-
-    t->m_len = 0;
-    t->m_buf[0] = '\0';
+    tok.offset = (uint32_t)t->m_start;
+    tok.len = (uint32_t)(t->m_index - t->m_start);
+    tok.sym = SYMBOL_NONE;
+    tok.lit = 0;
+    *out = tok;
+    return 1;
 }
 
 // ---------- Tokenizer ----------
 
-TokenArray tokenize(Token_data* t) {
-    TokenArray tokens;
-    kv_init(tokens);
-
+// lex the next token into *out, returns 0 at the end of the source.
+// the parser pulls from this directly when streaming
+int tokenizer_next(Token_data* t, Token* out) {
     char c;
     while ((c = peek(t, 0)) != INVALID_CHAR) {
-        if (isalpha(c)) {
+        t->m_start = t->m_index;
+        if (isspace(c)) {
+            // skip the whole whitespace run at once
+            t->m_index = scan_space(t->m_src, t->m_index, t->m_src_len);
+        } else if (isalpha(c)) {
             // read identifier / keyword
-            push_back(t, consume(t));
-            while (isalnum(peek(t,0))) {
-                push_back(t, consume(t));
-            }
-            if (strcmp(t->m_buf, "exit") == 0) {
-                push_token(t, &tokens, token_type_exit_kw);
-            } else if (strcmp(t->m_buf, "if") == 0) {
-                push_token(t, &tokens, token_type_if);
-            } else if (strcmp(t->m_buf, "else") == 0) {
-                push_token(t, &tokens, token_type_else);
-            } else if (strcmp(t->m_buf, "for") == 0) {
-                push_token(t, &tokens, token_type_for);
-            } else if (strcmp(t->m_buf, "while") == 0) {
-                push_token(t, &tokens, token_type_while);
-            } else if (strcmp(t->m_buf, "for") == 0) {
-                push_token(t, &tokens, token_type_for);
-            } else if (strcmp(t->m_buf, "int") == 0) {
-                push_token(t, &tokens, token_type_int);
-            } else if (strcmp(t->m_buf, "char") == 0) {
-                push_token(t, &tokens, token_type_char_t);
-            } else if (strcmp(t->m_buf, "short") == 0) {
-                push_token(t,&tokens, token_type_short);
-            } else if (strcmp(t->m_buf, "long") == 0) {
-                push_token(t,&tokens, token_type_long);
-            } else if (strcmp(t->m_buf, "return") == 0) {
-                push_token(t,&tokens, token_type_return);
-            } else if (strcmp(t->m_buf, "void") == 0) {
-                push_token(t, &tokens, token_type_void);
-            } else {
-                push_token_value(t, &tokens, token_type_ident);
+            t->m_index = scan_ident(t->m_src, t->m_index + 1, t->m_src_len);
+            TokenType kw = keyword_lookup(t->m_src + t->m_start, t->m_index - t->m_start);
+            if (kw != token_type_ident) {
+                return push_token(t, out, kw);
             }
+            return push_token_value(t, out, token_type_ident);
 
         } else if (isdigit(c)) {
-            // read number literal
-            push_back(t, consume(t));
-            while (isdigit(peek(t,0))) {
-                push_back(t, consume(t));
+            // read number literal, 0x.. and 0b.. take every alnum after the prefix
+            // so decode_int_lit can reject bad digits instead of splitting the token
+            char p1 = peek(t, 1);
+            if (c == '0' && (p1 == 'x' || p1 == 'X' || p1 == 'b' || p1 == 'B') && isalnum(peek(t, 2))) {
+                t->m_index = scan_ident(t->m_src, t->m_index + 2, t->m_src_len);
+            } else {
+                t->m_index = scan_digits(t->m_src, t->m_index + 1, t->m_src_len);
             }
-            push_token_value(t, &tokens, token_type_int_lit);
+            return push_token_value(t, out, token_type_int_lit);
 
         } else {
             consume(t); 
             switch (c) {
-                case '(': push_token(t, &tokens, token_type_open_paren); break;
-                case ')': push_token(t, &tokens, token_type_close_paren); break;
-                case ';': push_token(t, &tokens, token_type_semi); break;
+                case '(': return push_token(t, out, token_type_open_paren);
+                case ')': return push_token(t, out, token_type_close_paren);
+                case ';': return push_token(t, out, token_type_semi);
                 case '=': 
                     
                     if (peek(t,0) != INVALID_CHAR && peek(t,0) == '=') {
-                        push_token(t, &tokens, token_type_cmp);
                         consume(t); // consume second equal
-                         break;
+                        return push_token(t, out, token_type_cmp);
                     } else {
-                        push_token(t, &tokens, token_type_eq_kw); break;
+                        return push_token(t, out, token_type_eq_kw);
                     }
                 case '<':
                     if (peek(t,0) != INVALID_CHAR && peek(t,0) == '=') {
-                        push_token(t, &tokens, token_type_less_eq);
                         consume(t); // consume second equal
-                         break;
+                        return push_token(t, out, token_type_less_eq);
                     } else {
-                        push_token(t, &tokens, token_type_less); break;
+                        return push_token(t, out, token_type_less);
                     }
                 case '>':
                     if (peek(t,0) != INVALID_CHAR && peek(t,0) == '=') {
-                        push_token(t, &tokens, token_type_more_eq);
                         consume(t); // consume second equal
-                         break;
+                        return push_token(t, out, token_type_more_eq);
                     } else {
-                        push_token(t, &tokens, token_type_more); break;
+                        return push_token(t, out, token_type_more);
                     }
                 case '!':
                     if (peek(t,0) != INVALID_CHAR && peek(t,0) == '=') {
-                        push_token(t, &tokens, token_type_not_eq);
                         consume(t); // consume second equal
-                         break;
+                        return push_token(t, out, token_type_not_eq);
                     } else {
-                        printf("unexcpected !");
-                        exit(1);
+                        lex_error(t, t->m_start, "unexpected '!'");
+                    }
+                case '&':
+                    if (peek(t,0) == '&') {
+                        consume(t); // second &
+                        return push_token(t, out, token_type_and);
                     }
+                    lex_error(t, t->m_start, "unexpected '&'");
+                case '|':
+                    if (peek(t,0) == '|') {
+                        consume(t); // second |
+                        return push_token(t, out, token_type_or);
+                    }
+                    lex_error(t, t->m_start, "unexpected '|'");
                 case '\'':
-                    push_back(t, consume(t));
+                    // value span is the character between the quotes
+                    t->m_start = t->m_index;
                     consume(t);
-                    push_token_value(t, &tokens, token_type_char_v);
+                    if (push_token_value(t, out, token_type_char_v)) {
+                        consume(t); // closing quote
+                        return 1;
+                    }
                     break;
-                case ',': push_token(t, &tokens, token_type_comma); break;
-                case '+': push_token(t, &tokens, token_type_plus); break;
-                case '*': push_token(t, &tokens, token_type_multi); break;
-                case '/': push_token(t, &tokens, token_type_divide); break;
-                case '-': push_token(t, &tokens, token_type_minus); break;
-                case '{': push_token(t, &tokens, token_type_open_braces); break;
-                case '}': push_token(t, &tokens, token_type_close_braces); break;                default: break; // ignore whitespace or unknown chars
+                case ',': return push_token(t, out, token_type_comma);
+                case '+': return push_token(t, out, token_type_plus);
+                case '*': return push_token(t, out, token_type_multi);
+                case '/': return push_token(t, out, token_type_divide);
+                case '-': return push_token(t, out, token_type_minus);
+                case '{': return push_token(t, out, token_type_open_braces);
+                case '}': return push_token(t, out, token_type_close_braces);                default: break; // ignore whitespace or unknown chars
+            }
+        }
+    }
+
+    return 0;
+}
+
+TokenStore tokenize(Token_data* t) {
+    TokenStore tokens;
+    token_store_init(&tokens);
+
+    Token tok;
+    while (tokenizer_next(t, &tok)) {
+        token_store_push(&tokens, tok);
+    }
+    return tokens;
+}
+
+// ---------- Incremental re-lex ----------
+// the lexer carries no state from one token to the next, so two lexers that
+// start a token at the same spot of the same text produce the same stream from
+// there on. after an edit only the tokens from just before it up to the first
+// token start that lines up with an old one (shifted by the edit) are lexed again.
+
+// byte after the last source char of token i, a char literal also owns its closing quote
+static size_t token_store_end(const TokenStore* s, size_t i) {
+    size_t end = (size_t)s->offset[i] + s->len[i];
+    if (s->kind[i] == token_type_char_v) end++;
+    return end;
+}
+
+TokenStore tokenize_edit(const TokenStore* old, StringView src, SourceEdit edit) {
+    int64_t shift = (int64_t)edit.new_len - (int64_t)edit.old_len;
+    size_t new_end = edit.start + edit.new_len; // end of the edit in the new source
+
+    // keep every token that ends before the edit with a byte to spare,
+    // a token touching the edit could grow into the inserted text
+    size_t lo = 0, hi = old->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (token_store_end(old, mid) < edit.start) lo = mid + 1;
+        else hi = mid;
+    }
+    size_t keep = lo;
+
+    TokenStore tokens;
+    token_store_init(&tokens);
+    token_store_reserve(&tokens, old->n);
+    token_store_append(&tokens, old, 0, keep, 0);
+
+    Token_data t;
+    t.m_src = src.data;
+    t.m_src_len = src.size;
+    t.m_index = keep ? token_store_end(old, keep - 1) : 0;
+    t.m_start = t.m_index;
+    scan_init();
+
+    size_t j = keep; // next old token that could line up
+    Token tok;
+    while (tokenizer_next(&t, &tok)) {
+        if (tok.offset >= new_end) {
+            while (j < old->n && (int64_t)old->offset[j] + shift < (int64_t)tok.offset) j++;
+            // same kind too: a char literal's offset is its inner char, not where lexing started
+            if (j < old->n && (int64_t)old->offset[j] + shift == (int64_t)tok.offset
+                && old->kind[j] == (uint8_t)tok.type) {
+                // back in step with the old stream, the rest only moves
+                token_store_append(&tokens, old, j, old->n, shift);
+                return tokens;
             }
         }
+        token_store_push(&tokens, tok);
+    }
+    return tokens;
+}
+
+// ---------- Parallel tokenizer ----------
+// the source is cut at whitespace into chunks that are lexed on their own threads.
+// every chunk lexer views the whole file with its bounds narrowed, so token
+// offsets come out global and the chunk results only have to be concatenated.
+
+typedef struct LexChunk {
+    Token_data* t;
+    TokenStore out;
+} LexChunk;
+
+static void* lex_chunk_worker(void* arg) {
+    LexChunk* chunk = (LexChunk*)arg;
+    chunk->out = tokenize(chunk->t);
+    return NULL;
+}
+
+// first position >= pos that is safe to split at: whitespace that is not the
+// character of a ' ' literal. tokens never contain whitespace otherwise
+static size_t find_split(const char* s, size_t pos, size_t n) {
+    for (; pos < n; pos++) {
+        if (!isspace((unsigned char)s[pos])) continue;
+        if (pos > 0 && pos + 1 < n && s[pos - 1] == '\'' && s[pos + 1] == '\'') continue;
+        return pos;
+    }
+    return n;
+}
+
+TokenStore tokenize_parallel(StringView src, int n_chunks) {
+    // not worth a thread for less than this much source
+    size_t max_chunks = src.size / PARALLEL_LEX_MIN_CHUNK;
+    if (n_chunks < 1) n_chunks = 1;
+    if ((size_t)n_chunks > max_chunks) n_chunks = max_chunks ? (int)max_chunks : 1;
+
+    LexChunk* chunks = (LexChunk*)calloc(n_chunks, sizeof(LexChunk));
+    pthread_t* threads = (pthread_t*)calloc(n_chunks, sizeof(pthread_t));
+    if (!chunks || !threads) { fprintf(stderr, "Out of memory\n"); exit(1); }
+
+    size_t start = 0;
+    int used = 0;
+    for (int i = 0; i < n_chunks && start < src.size; i++) {
+        size_t end = (i == n_chunks - 1) ? src.size
+                   : find_split(src.data, src.size / n_chunks * (i + 1), src.size);
+        if (end < start) end = start;
+        Token_data* t = tokenizer_create(src);
+        t->m_index = start;
+        t->m_src_len = end;
+        chunks[used].t = t;
+        used++;
+        start = end;
+    }
+
+    for (int i = 1; i < used; i++) {
+        if (pthread_create(&threads[i], NULL, lex_chunk_worker, &chunks[i]) != 0) {
+            // no thread, lex it here once the others are started
+            threads[i] = 0;
+        }
+    }
+    lex_chunk_worker(&chunks[0]);
+    for (int i = 1; i < used; i++) {
+        if (threads[i]) pthread_join(threads[i], NULL);
+        else lex_chunk_worker(&chunks[i]);
+    }
+
+    // stitch the chunks together in source order
+    size_t total = 0;
+    for (int i = 0; i < used; i++) total += chunks[i].out.n;
+
+    TokenStore tokens;
+    token_store_init(&tokens);
+    token_store_reserve(&tokens, total);
+
+    for (int i = 0; i < used; i++) {
+        TokenStore* part = &chunks[i].out;
+        token_store_append(&tokens, part, 0, part->n, 0);
+        token_store_free(part);
+        free(chunks[i].t);
     }
 
+    free(chunks);
+    free(threads);
     return tokens;
 }
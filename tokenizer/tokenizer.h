@@ -1,15 +1,22 @@
 #pragma once
 
 #include "../libs/kvec.h"
+#include "intern/intern.h"
+#include "lines/lines.h"
 #include <stddef.h>
+#include <stdint.h>
 
-#define BUF_SIZE 256
+// view over the source, points straight into the mmap'd file (not null terminated)
+typedef struct {
+    char *data;
+    size_t size;
+} StringView;
 
 typedef struct Token_data {
-    int m_index;
-    char* m_src;
-    char m_buf[BUF_SIZE];
-    size_t m_len;
+    size_t m_index;
+    const char* m_src;
+    size_t m_src_len;
+    size_t m_start; // first byte of the token being lexed
 } Token_data;
 
 typedef enum {
@@ -51,25 +58,85 @@ typedef enum {
 
 } TokenType;
 
+// span into the source plus the interned text, no per token allocation
 typedef struct Token {
     TokenType type;
-    char* value;
+    uint32_t offset;
+    uint32_t len;
+    Symbol sym; // SYMBOL_NONE for tokens without a value
+    int64_t lit; // decoded value of int / char literals, 0 otherwise
 } Token;
 
 typedef kvec_t(Token) TokenArray;
 
+typedef struct TokenLit {
+    uint32_t token; // index of the literal token in the store
+    int64_t value;
+} TokenLit;
+
+// lexer output, struct of arrays so lookahead only has to touch the kind byte
+typedef struct TokenStore {
+    size_t n, m;
+    uint8_t* kind;    // TokenType
+    uint32_t* offset; // byte offset into the source
+    uint32_t* len;
+    Symbol* sym;      // value side table, SYMBOL_NONE for tokens without a value
+    kvec_t(TokenLit) lits; // literal values, only literal tokens have an entry (sorted by token)
+} TokenStore;
+
+void token_store_init(TokenStore* s);
+void token_store_push(TokenStore* s, Token tok);
+void token_store_free(TokenStore* s);
+int64_t token_store_lit(const TokenStore* s, size_t i);
+
+static inline int is_literal_kind(TokenType type) {
+    return type == token_type_int_lit || type == token_type_char_v;
+}
+
+static inline TokenType token_store_kind(const TokenStore* s, size_t i) {
+    return (TokenType)s->kind[i];
+}
+
+static inline Token token_store_get(const TokenStore* s, size_t i) {
+    Token tok;
+    tok.type = (TokenType)s->kind[i];
+    tok.offset = s->offset[i];
+    tok.len = s->len[i];
+    tok.sym = s->sym[i];
+    tok.lit = is_literal_kind(tok.type) ? token_store_lit(s, i) : 0;
+    return tok;
+}
+
 // Token_data functions
-Token_data* tokenizer_create(const char* src);
+Token_data* tokenizer_create(StringView src);
 
 // Token handling
-void push_token(Token_data* t, TokenArray* tokens, TokenType type);
-void push_token_value(Token_data* t, TokenArray* tokens, TokenType type);
+const char* token_value(Token tok);
+int push_token(Token_data* t, Token* out, TokenType type);
+int push_token_value(Token_data* t, Token* out, TokenType type);
 
 // Tokenizer
-TokenArray tokenize(Token_data* t);
+int tokenizer_next(Token_data* t, Token* out); // pull one token, 0 at end
+TokenStore tokenize(Token_data* t);            // whole source at once
+
+// old source bytes [start, start + old_len) were replaced by new_len bytes
+typedef struct SourceEdit {
+    size_t start;
+    size_t old_len;
+    size_t new_len;
+} SourceEdit;
+
+// tokens of src (the source after the edit) from the tokens of the source
+// before it, only the region around the edit is lexed again
+TokenStore tokenize_edit(const TokenStore* old, StringView src, SourceEdit edit);
+
+// smallest piece of source worth giving its own lexer thread
+#define PARALLEL_LEX_MIN_CHUNK (256 * 1024)
+
+// lex src on up to n_chunks threads, same result as tokenize()
+TokenStore tokenize_parallel(StringView src, int n_chunks);
 
 // Inline helpers
 // can be used only in tokenizer.c aka private functions
 static inline char peek(Token_data* t, int offset);
 static inline char consume(Token_data* t);
-static inline void push_back(Token_data* t, char c);